@@ -21,8 +21,10 @@
 #include "protocol_examples_common.h"
 #include "esp_crt_bundle.h"
 #include "esp_http_client.h"
+#include "lwip/sockets.h"
 #include "esp_timer.h"
 #include "esp_spiffs.h"
+#include "esp_heap_caps.h"
 #include <dirent.h>
 #include <errno.h>
 
@@ -31,34 +33,93 @@
 #include "freertos/semphr.h"
 #include "freertos/event_groups.h"
 #include "freertos/timers.h"
+#include "freertos/ringbuf.h"
 
 #include "esp_log.h"
 #include "esp_websocket_client.h"
 #include "esp_event.h"
 #include <cJSON.h>
 #include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
 
-// 增加定时器服务任务栈大小
-#define TIMER_SERVICE_TASK_STACK_SIZE 8192  // 之前是4096，增加到8192
-
-#define HEARTBEAT_INTERVAL_SEC  5  // 心跳间隔（秒）
+#define HEARTBEAT_INTERVAL_SEC  5  // 心跳/遥测间隔（秒）
+#define TELEMETRY_TASK_STACK_SIZE 4096  // 遥测任务栈大小
+#define TELEMETRY_TASK_PRIORITY 1       // 遥测任务优先级（低于所有传输任务）
 #define DEVICE_VERSION          "1.0.0"
-#define RECONNECT_INTERVAL_SEC  5   // 重连间隔（秒）
-#define MAX_RECONNECT_ATTEMPTS  10  // 最大重连尝试次数
+#define RECONNECT_BACKOFF_MIN_MS 1000   // 重连退避起始间隔（毫秒）
+#define RECONNECT_BACKOFF_MAX_MS 60000  // 重连退避间隔上限（毫秒）
 #define PROGRESS_BAR_WIDTH      50  // 进度条宽度
 #define MAX_FILE_SIZE           (1024*1024)  // 最大文件大小限制(1MB)
-#define BUFFER_SIZE             4096   // 文件传输缓冲区大小
+#define BUFFER_SIZE             4096   // 内部RAM传输缓冲区大小（无PSRAM时的回退值）
+#define PSRAM_BUFFER_SIZE       (64*1024)  // PSRAM传输缓冲区大小，减少HTTP读取往返次数
 #define WS_TASK_STACK_SIZE      4096  // WebSocket处理任务栈大小
 #define WS_TASK_PRIORITY        5     // WebSocket处理任务优先级
+
+// 双核任务布局：协议/网络任务与lwIP同在核0，flash写入与哈希计算
+// 固定在核1，避免flash操作阻塞同核的TCP栈ACK处理。
+// 跨核切换的队列交接本身开销极小，换来两类负载互不抢占。
+#define CORE_NET                0     // 网络/协议核（lwIP、WiFi驱动所在核）
+#define CORE_WORK               1     // flash I/O与哈希计算核
 #define WS_QUEUE_SIZE           10    // WebSocket事件队列大小
+#define RX_POOL_SLOT_COUNT      8     // RX消息池槽位数量
+#define RX_POOL_SLOT_SIZE       2048  // RX消息池单个槽位容量（字节）
+#define DL_PIPE_BUF_COUNT       2     // 下载流水线缓冲区数量（双缓冲）
+#define DL_WRITER_TASK_STACK_SIZE 4096 // 下载写入任务栈大小
+#define DL_RESUME_CHECKPOINT    (64*1024)  // 断点续传状态保存间隔（字节）
+#define DL_RESUME_MAGIC         0x52455355 // 断点状态文件魔数"RESU"
+#define DL_JOB_QUEUE_DEPTH      8     // 下载任务队列深度
+#define DL_WORKER_COUNT         2     // 下载工作任务数量（并行HTTP会话数）
+#define DL_WORKER_TASK_STACK_SIZE 8192 // 下载工作任务栈大小
+#define DL_SMALL_FILE_THRESHOLD (64*1024)  // 小于该值的文件走高优先级队列
+#define FILE_LIST_CHUNK_ENTRIES 4     // 每帧file_list携带的最大文件条目数
+#define DL_STAGE_MAX_SIZE       (256*1024) // 整文件PSRAM暂存下载的大小上限
+#define DL_PARALLEL_CONNS       2     // 大文件并行Range下载的连接数
+#define DL_PATCH_MAGIC          0x31544C44 // 补丁文件魔数"DLT1"
+#define DL_PATCH_MAX_SIZE       (128*1024) // 补丁体积上限
+#define HTTP_POOL_SIZE          2     // 按主机缓存的持久HTTP连接数
+#define HTTP_POOL_IDLE_TIMEOUT_SEC 30 // 空闲连接超时（秒）
+#define STREAM_RING_SIZE        (128*1024) // 流式播放PSRAM环形缓冲区大小
+#define STREAM_PREBUFFER        (STREAM_RING_SIZE/2) // 起播前的预缓冲水位
+#define STREAM_CHUNK_SIZE       4096  // 流式播放的单次读写粒度
+#define STREAM_TASK_STACK_SIZE  4096  // 流式播放任务栈大小
+#define TX_QUEUE_DEPTH          16    // 出站可靠消息队列深度
+#define TX_MSG_MAX_LEN          1024  // 单条出站消息上限（与file_list帧一致）
+#define TX_PROGRESS_SLOTS       4     // 进度消息合并槽数
+#define TX_ENQUEUE_TIMEOUT_MS   500   // 可靠消息入队超时
+#define TX_SENDER_TASK_STACK_SIZE 4096 // 发送任务栈大小
+#define TX_SENDER_TASK_PRIORITY 3     // 发送任务优先级（传输任务之下，遥测之上）
+#define SPIFFS_INIT_TASK_STACK_SIZE 4096 // SPIFFS并行初始化任务栈大小
+#define ALOG_RING_SIZE          64    // 异步日志环形缓冲条目数（需为2的幂）
+#define ALOG_DRAIN_INTERVAL_MS  50    // 日志排空任务的轮询间隔
+#define ALOG_TASK_STACK_SIZE    3072  // 日志排空任务栈大小
+#define MCAST_MAGIC             0x4D435331 // 组播数据包魔数"MCS1"
+#define MCAST_CHUNK_SIZE        1024  // 组播数据块载荷大小
+#define MCAST_FEC_GROUP         8     // FEC组大小：每8个数据块附1个XOR校验块
+#define MCAST_IDLE_TIMEOUT_SEC  5     // 组播接收空闲超时（秒）
+#define MCAST_REPAIR_MAX_RATIO  4     // 缺块多于总数1/4时放弃修复，退回单播下载
+#define DL_RANGE_TASK_STACK_SIZE 4096 // Range下载任务栈大小
+#define UL_READER_TASK_STACK_SIZE 4096 // 上传预读任务栈大小
+#define BENCH_TASK_STACK_SIZE   8192  // 基准测试任务栈大小
+#define BENCH_FILE_PATH         "/spiffs/.bench"  // 基准测试临时文件
+#define BENCH_FILE_SIZE         (128*1024)  // SPIFFS读写测试的数据量
+#define BENCH_HASH_SIZE         (256*1024)  // 哈希吞吐测试的数据量
 
 static const char *TAG = "esp_websocket_client";
 
+// RX消息池槽位：预分配的固定大小消息缓冲区
+// 事件回调中无锁申请，handle_ws_event处理完后释放，热路径上无malloc/free
+typedef struct {
+    volatile uint32_t in_use;       // 0空闲，1占用，CAS原子声明
+    char data[RX_POOL_SLOT_SIZE];   // 消息数据（含结尾'\0'）
+} rx_slot_t;
+
 // 全局变量
 static esp_websocket_client_handle_t client = NULL;
-static TimerHandle_t heartbeat_timer = NULL;
 static TimerHandle_t reconnect_timer = NULL;  // 重连定时器
-static int reconnect_attempts = 0;  // 重连尝试次数
+static uint32_t reconnect_backoff_ms = RECONNECT_BACKOFF_MIN_MS;  // 当前重连退避时长
+static volatile bool telemetry_enabled = false;  // 连接建立后置位，遥测任务据此决定是否发送
+static volatile bool binary_proto = false;  // online握手协商出二进制帧模式后置位
 static char device_mac[18];  // MAC地址字符串 "XX:XX:XX:XX:XX:XX"
 static char device_id[32];   // 设备ID
 
@@ -66,6 +127,134 @@ static char device_id[32];   // 设备ID
 static QueueHandle_t ws_event_queue = NULL;
 static TaskHandle_t ws_task_handle = NULL;
 
+// RX消息池：websocket_app_start()时一次性分配
+static rx_slot_t *rx_pool = NULL;
+
+// 下载任务队列：小文件（配置等）走高优先级队列，插队到大音频文件之前
+static QueueHandle_t dl_job_queue_high = NULL;
+static QueueHandle_t dl_job_queue_normal = NULL;
+
+// 文件列表互斥锁：多个下载工作任务会并发更新device_files
+static SemaphoreHandle_t file_list_mutex = NULL;
+
+// HTTP连接池：按主机+端口缓存持久连接，顺序传输同一服务器的多个文件
+// 时免去重复的TCP/TLS握手。TLS握手的CPU开销（1~2秒）在批量推送中
+// 被摊薄到只剩第一次。
+typedef struct {
+    esp_http_client_handle_t client; // 缓存的客户端句柄，NULL表示空槽
+    char host[64];                   // 目标主机
+    int port;                        // 目标端口
+    int64_t last_used;               // 最近归还时间（秒）
+    bool in_use;                     // 是否被某次传输占用
+} http_pool_entry_t;
+
+static http_pool_entry_t http_pool[HTTP_POOL_SIZE];
+static SemaphoreHandle_t http_pool_mutex = NULL;
+
+// 出站消息队列：传输循环不再直接碰socket。可靠消息（完成通知、
+// 清单、确认）经FIFO保序发送；进度消息按文件名进入合并槽，
+// 新进度覆盖旧进度——拥塞时服务器看到的永远是最新状态，而不是
+// 一串过期百分比或干脆丢失。唯一的发送任务串行清空两者。
+typedef struct {
+    bool binary;       // 二进制帧还是JSON文本
+    uint16_t len;      // 负载长度
+    char data[];       // 负载
+} tx_msg_t;
+
+typedef struct {
+    bool valid;                 // 槽内是否有待发进度
+    bool binary;                // 帧格式
+    char filename[32];          // 合并键
+    uint16_t len;               // 负载长度
+    char payload[192];          // 进度帧（JSON或bin_progress_t都放得下）
+} tx_progress_slot_t;
+
+static QueueHandle_t tx_reliable_queue = NULL;
+static tx_progress_slot_t tx_progress_slots[TX_PROGRESS_SLOTS];
+static SemaphoreHandle_t tx_progress_mutex = NULL;
+
+// 热路径性能计数器：原子自增，每次更新只有几条指令，
+// 通过stats协议消息和心跳遥测上报，现场调优无需接串口
+typedef struct {
+    uint32_t bytes_downloaded;   // 累计下载字节数
+    uint32_t bytes_uploaded;     // 累计上传字节数
+    uint32_t downloads_ok;       // 成功下载次数
+    uint32_t downloads_failed;   // 失败下载次数
+    uint32_t ws_rx_messages;     // 收到的WebSocket数据消息数
+    uint32_t ws_queue_drops;     // 事件队列满丢弃的消息数
+    uint32_t rx_pool_fallbacks;  // RX池耗尽回退堆分配的次数
+    uint32_t alloc_failures;     // 内存分配失败次数
+    uint64_t net_read_us;        // 网络读取累计耗时（微秒）
+    uint64_t flash_write_us;     // flash写入累计耗时（微秒）
+    uint64_t hash_us;            // 哈希计算累计耗时（微秒）
+} perf_stats_t;
+
+static perf_stats_t perf_stats;
+
+// 计数器原子更新
+#define STAT_ADD(field, v) __atomic_add_fetch(&perf_stats.field, (v), __ATOMIC_RELAXED)
+
+// 异步日志：传输与消息热路径上的UART写入在115200波特率下以毫秒计，
+// 实测能吃掉10%以上的下载吞吐。热路径改为向无锁环形缓冲追加紧凑
+// 记录（格式串指针+两个整型参数，微秒级），由低优先级任务批量排空
+// 到UART。格式串必须是字符串字面量——排空时才格式化。
+// 冷路径（连接事件、错误）仍直接用ESP_LOGx。
+typedef enum {
+    LOG_SUBSYS_TRANSFER = 0,  // 下载/上传数据通路
+    LOG_SUBSYS_WS,            // WebSocket消息收发
+    LOG_SUBSYS_COUNT,
+} log_subsys_t;
+
+typedef struct {
+    volatile uint32_t seq;    // 写完成标记：等于槽序号+1时记录有效
+    uint8_t level;            // esp_log_level_t
+    uint8_t subsys;           // log_subsys_t
+    const char *fmt;          // 字符串字面量，最多两个整型占位符
+    int32_t arg1;             // 第一个参数
+    int32_t arg2;             // 第二个参数
+} alog_record_t;
+
+static alog_record_t alog_ring[ALOG_RING_SIZE];
+static volatile uint32_t alog_head = 0;      // 多生产者原子递增
+static uint32_t alog_tail = 0;               // 仅排空任务访问
+static volatile uint32_t alog_dropped = 0;   // 环满丢弃计数
+
+// 各子系统的运行期日志级别，可由服务器log_config消息调整
+static volatile uint8_t alog_subsys_level[LOG_SUBSYS_COUNT] = {
+    ESP_LOG_INFO, ESP_LOG_INFO,
+};
+
+// 向环形缓冲追加一条记录，满时丢弃（日志不反压热路径）。
+// 用CAS抢占槽位：丢弃时head不前进，环里不会留下永远不就绪的空洞
+static void alog_append(uint8_t subsys, uint8_t level, const char *fmt,
+                        int32_t arg1, int32_t arg2)
+{
+    uint32_t idx;
+    do {
+        idx = __atomic_load_n(&alog_head, __ATOMIC_RELAXED);
+        if (idx - alog_tail >= ALOG_RING_SIZE) {
+            __atomic_add_fetch(&alog_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&alog_head, &idx, idx + 1, false,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    alog_record_t *rec = &alog_ring[idx & (ALOG_RING_SIZE - 1)];
+    rec->level = level;
+    rec->subsys = subsys;
+    rec->fmt = fmt;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    // 发布标记最后写入，排空侧看到它即可安全读取整条记录
+    __atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+// 热路径日志宏：级别检查只是一次数组读取，未启用时零开销
+#define ALOG(subsys, lvl, fmtstr, a, b) do { \
+    if ((lvl) <= alog_subsys_level[subsys]) { \
+        alog_append((subsys), (lvl), (fmtstr), (int32_t)(a), (int32_t)(b)); \
+    } \
+} while (0)
+
 // WebSocket事件类型
 typedef enum {
     WS_EVENT_CONNECTED,
@@ -82,42 +271,162 @@ typedef struct {
             int status_code;  // 状态码（用于断开连接和错误事件）
         } conn_info;
         struct {
-            char *data;       // 数据指针
+            char *data;       // 数据指针（指向槽位内部或超大消息的堆内存）
+            rx_slot_t *slot;  // 所属池槽位，NULL表示走堆分配的超大消息回退路径
             int data_len;     // 数据长度
             int op_code;      // WebSocket操作码
         } data_info;
     };
 } ws_event_msg_t;
 
-// 模拟的文件列表
+// 设备文件清单条目。同一逻辑名可同时存在多个槽位（A/B内容槽）：
+// 新版本下载到暂存名并校验通过后，激活只是翻转active标记并持久化
+// 索引——播放侧要么看到完整的旧版本，要么看到完整的新版本。
 typedef struct {
     char filename[32];
     int size;
-    char md5[33];  // MD5是32个字符
+    char md5[65];  // MD5为32字符，SHA-256为64字符
     int64_t timestamp;
+    int64_t last_access;  // 最后访问时间（秒），淘汰时挑选依据
+    uint8_t pinned;       // 服务器标记的固定文件（活跃播放列表），永不淘汰
+    char logical[32];     // 逻辑文件名（服务器侧原名），A/B槽位按此关联
+    uint8_t active;       // 1=当前活跃版本；旧版本保留为回滚候选直到被淘汰
 } file_info_t;
 
-#define MAX_FILES 5
-static file_info_t device_files[MAX_FILES];
+// 持久化文件索引：紧凑二进制清单，掉电重启后仍能向服务器
+// 上报已有文件，避免服务器把全部内容重新推送一遍
+#define FILE_INDEX_PATH     "/spiffs/.fileindex"
+#define FILE_INDEX_TMP_PATH "/spiffs/.fileindex.tmp"
+#define FILE_INDEX_MAGIC    0x33444946  // 索引文件魔数"FID3"（v3：含A/B槽位字段）
+#define FILE_INDEX_INITIAL_CAPACITY 16  // 索引数组初始容量
+#define FILE_INDEX_MAX_ENTRIES 4096     // 索引条目上限，SPIFFS放不下更多文件
+
+// 索引文件头，后接count个file_info_t记录
+typedef struct {
+    uint32_t magic;  // 魔数
+    int count;       // 记录数量
+} file_index_header_t;
+
+static file_info_t *device_files = NULL;  // 动态增长，不再有5个文件的上限
 static int file_count = 0;
+static int file_capacity = 0;
+
+// 下载任务描述：handle_ws_event入队，下载工作任务出队执行
+typedef struct {
+    char url[192];       // 下载URL
+    char filename[64];   // 原始文件名
+    char md5[33];        // 预期MD5（可选）
+    char sha256[65];     // 预期SHA-256（可选）
+    bool has_md5;        // 是否携带MD5
+    bool has_sha256;     // 是否携带SHA-256
+    int size;            // 文件大小（解压后）
+    char content_encoding[16]; // 传输编码（"deflate"或空串表示不压缩）
+    char patch_url[192]; // 增量补丁URL（可选）
+    char base_md5[65];   // 补丁基准文件的哈希（可选）
+    int patch_size;      // 补丁字节数
+    bool has_patch;      // 是否携带增量补丁信息
+    char mcast_group[16]; // 组播组地址（可选，群发会话）
+    int mcast_port;      // 组播端口
+    bool has_mcast;      // 是否携带组播会话信息
+    int rate_limit_kbps; // 服务器下发的限速提示，0表示不限速
+} dl_job_t;
+
+// 二进制帧协议：online握手时客户端声明支持，服务器在online_ack中
+// 携带"binary":true后启用。高频消息（心跳、进度）从格式化JSON变成
+// 定长打包结构体，接收侧按首字节标签分发，无需字符串比较。
+// JSON路径完整保留，用于旧服务器和低频消息。
+typedef enum {
+    BIN_MSG_HEARTBEAT       = 0x01,  // 心跳遥测帧
+    BIN_MSG_PROGRESS        = 0x02,  // 传输进度帧
+    BIN_MSG_DOWNLOAD_NOTIFY = 0x10,  // 服务器下发的下载通知
+    BIN_MSG_ACK             = 0x20,  // 服务器确认帧
+} bin_msg_tag_t;
+
+// 二进制心跳帧：16字节，替代约64字节的格式化JSON
+typedef struct __attribute__((packed)) {
+    uint8_t tag;            // BIN_MSG_HEARTBEAT
+    int64_t timestamp;      // 秒
+    uint32_t free_heap;     // 当前空闲堆
+    int8_t rssi;            // WiFi信号强度
+    uint16_t spiffs_free_kb; // SPIFFS剩余空间（KB）
+} bin_heartbeat_t;
+
+// 二进制进度帧
+typedef struct __attribute__((packed)) {
+    uint8_t tag;         // BIN_MSG_PROGRESS
+    uint8_t kind;        // 0=下载 1=上传
+    uint8_t percent;     // 完成百分比
+    int32_t transferred; // 已传输字节数
+    int32_t total_size;  // 总字节数
+    char filename[32];   // 文件名（截断存储）
+} bin_progress_t;
+
+// 二进制下载通知帧（服务器->设备）
+typedef struct __attribute__((packed)) {
+    uint8_t tag;         // BIN_MSG_DOWNLOAD_NOTIFY
+    int32_t size;        // 文件大小
+    char md5[33];        // 预期MD5，空字符串表示未提供
+    char sha256[65];     // 预期SHA-256，空字符串表示未提供
+    char filename[64];   // 文件名
+    char url[192];       // 下载URL
+} bin_download_notify_t;
 
 // 函数声明
 static void send_online_message(void);
 static void send_file_list(void);
-static esp_err_t download_file(const char *url, const char *filename, const char *expected_md5, int file_size);
-static void send_download_complete(const char *filename, const char *md5);
+static void send_file_list_delta(const file_info_t *info);
+static esp_err_t download_file(const char *url, const char *filename, const char *expected_md5, const char *expected_sha256, int file_size, const char *content_encoding, int rate_limit_kbps);
+static esp_err_t download_file_patch(const dl_job_t *job);
+static esp_err_t download_file_mcast(const dl_job_t *job);
+static void send_download_complete(const char *filename, const char *hash_key, const char *hash);
 static esp_err_t upload_file(const char *filename, const char *url);
 static void handle_upload_request(const char *message);
 static void send_upload_complete(const char *filename, const char *md5);
-static void heartbeat_timer_callback(TimerHandle_t xTimer);
+static void telemetry_task(void *pvParameter);  // 心跳与遥测任务
 static void reconnect_timer_callback(TimerHandle_t xTimer);  // 重连定时器回调
 static void reset_connection_state(void);  // 复位连接状态
-static void attempt_reconnect(void);  // 尝试重连
+static void schedule_reconnect(void);  // 按指数退避调度下一次重连
 static esp_err_t init_spiffs(void);
+static void spiffs_scan_task(void *pvParameter);  // 延迟目录枚举
+static esp_err_t file_index_load(void);
+static void file_index_save(void);
+static bool file_index_add(const file_info_t *info);
+static void file_index_touch(const char *filename);
+static esp_err_t evict_for_space(int needed);
 static void send_progress_notification(const char *type, const char *filename, int percent, int transferred, int total_size);
+static void send_stats(void);
+static void benchmark_task(void *pvParameter);  // 基准测试任务
+static esp_err_t stream_session_start(const char *url, const char *filename, int size);  // 启动流式播放会话
+static esp_http_client_handle_t http_pool_acquire(const char *url);  // 从连接池取HTTP句柄
+static void http_pool_release(esp_http_client_handle_t pooled, bool reusable);  // 归还HTTP句柄
+static void tx_enqueue_reliable(bool binary, const char *data, int len);  // 可靠发送入队
+static void tx_enqueue_progress(const char *filename, bool binary, const char *data, int len);  // 进度帧合并入队
 static void ws_event_task(void *pvParameter); // WebSocket事件处理任务
 static void handle_ws_event(ws_event_msg_t *msg); // 处理WebSocket事件
 
+// 分配传输缓冲区：模组带PSRAM时用64KB大块提高TCP窗口利用率，
+// 否则退回4KB内部RAM。实际大小通过out_size返回。
+static char *transfer_buf_alloc(size_t *out_size)
+{
+    char *buf = heap_caps_malloc(PSRAM_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buf != NULL) {
+        *out_size = PSRAM_BUFFER_SIZE;
+        return buf;
+    }
+
+    buf = malloc(BUFFER_SIZE);
+    if (buf != NULL) {
+        *out_size = BUFFER_SIZE;
+    }
+    return buf;
+}
+
+// 释放传输缓冲区（heap_caps分配的内存同样由free释放）
+static void transfer_buf_free(char *buf)
+{
+    free(buf);
+}
+
 // 日志辅助函数
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -126,23 +435,188 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
-// 简单地检查和提取消息类型，不使用cJSON
-static const char* get_message_type(const char* json_str) {
-    static char type_buffer[32];
-    char* type_start = strstr(json_str, "\"type\":\"");
-    if (type_start) {
-        type_start += 8; // 跳过 "type":"
-        char* type_end = strchr(type_start, '\"');
-        if (type_end && (type_end - type_start < sizeof(type_buffer) - 1)) {
-            int len = type_end - type_start;
-            memcpy(type_buffer, type_start, len);
-            type_buffer[len] = '\0';
-            return type_buffer;
+// 零分配JSON字段提取器：针对本协议已知的扁平schema直接扫描文本，
+// 不构建cJSON的DOM树。不处理转义字符——协议中的文件名/URL/哈希均不含转义。
+// 未知消息类型仍走cJSON完整解析的回退路径。
+
+// 提取字符串字段值，找到且放得下时返回true
+static bool json_extract_string(const char *json, const char *key, char *out, size_t out_size)
+{
+    // 构造 "key":" 模式
+    char pattern[48];
+    int pattern_len = snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if (pattern_len >= sizeof(pattern)) {
+        return false;
+    }
+
+    const char *pos = strstr(json, pattern);
+    if (pos == NULL) {
+        return false;
+    }
+    pos += pattern_len;
+
+    // 跳过空白，期望一个双引号开头的字符串值
+    while (*pos == ' ' || *pos == '\t') pos++;
+    if (*pos != '\"') {
+        return false;
+    }
+    pos++;
+
+    const char *end = strchr(pos, '\"');
+    if (end == NULL || (size_t)(end - pos) >= out_size) {
+        return false;
+    }
+
+    memcpy(out, pos, end - pos);
+    out[end - pos] = '\0';
+    return true;
+}
+
+// 提取整数字段值，找到时返回true
+static bool json_extract_int(const char *json, const char *key, int *out)
+{
+    char pattern[48];
+    int pattern_len = snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if (pattern_len >= sizeof(pattern)) {
+        return false;
+    }
+
+    const char *pos = strstr(json, pattern);
+    if (pos == NULL) {
+        return false;
+    }
+    pos += pattern_len;
+
+    while (*pos == ' ' || *pos == '\t') pos++;
+    if (*pos != '-' && (*pos < '0' || *pos > '9')) {
+        return false;
+    }
+
+    *out = atoi(pos);
+    return true;
+}
+
+// 简单地检查和提取消息类型（可重入版本，调用方提供缓冲区）
+static const char* get_message_type_r(const char* json_str, char *buf, size_t buf_size) {
+    if (json_extract_string(json_str, "type", buf, buf_size)) {
+        return buf;
+    }
+    return NULL;
+}
+
+// 无锁申请一个空闲的RX池槽位，全部占用时返回NULL
+static rx_slot_t *rx_pool_acquire(void)
+{
+    for (int i = 0; i < RX_POOL_SLOT_COUNT; i++) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&rx_pool[i].in_use, &expected, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return &rx_pool[i];
         }
     }
     return NULL;
 }
 
+// 释放RX池槽位
+static void rx_pool_release(rx_slot_t *slot)
+{
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// 释放消息携带的数据：池槽位归还池，超大消息回退路径走free
+static void ws_msg_release_data(ws_event_msg_t *msg)
+{
+    if (msg->data_info.slot != NULL) {
+        rx_pool_release(msg->data_info.slot);
+    } else {
+        free(msg->data_info.data);
+    }
+}
+
+// 下载工作任务：从任务队列取出下载作业并执行
+// 多个工作任务并行驱动独立的HTTP会话，批量推送时可重叠TCP慢启动
+static void dl_worker_task(void *pvParameter)
+{
+    dl_job_t job;
+
+    while (1) {
+        // 先查高优先级队列（小文件插队），再短暂等待普通队列
+        if (xQueueReceive(dl_job_queue_high, &job, 0) != pdTRUE &&
+            xQueueReceive(dl_job_queue_normal, &job, 100 / portTICK_PERIOD_MS) != pdTRUE) {
+            continue;
+        }
+
+        esp_err_t ret = ESP_FAIL;
+        if (job.has_patch) {
+            // 优先尝试增量补丁：本地有基准文件时只传输差异部分
+            ret = download_file_patch(&job);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "增量更新不可用，回退整文件下载: %s", job.filename);
+            }
+        }
+        if (ret != ESP_OK && job.has_mcast) {
+            // 群发会话：UDP组播收块，缺块走HTTP修复
+            ret = download_file_mcast(&job);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "组播接收失败，回退整文件下载: %s", job.filename);
+            }
+        }
+        if (ret != ESP_OK) {
+            ret = download_file(job.url, job.filename,
+                                job.has_md5 ? job.md5 : NULL,
+                                job.has_sha256 ? job.sha256 : NULL,
+                                job.size,
+                                job.content_encoding[0] ? job.content_encoding : NULL,
+                                job.rate_limit_kbps);
+        }
+        if (ret != ESP_OK) {
+            STAT_ADD(downloads_failed, 1);
+            ESP_LOGE(TAG, "文件下载失败: %s", job.filename);
+        } else {
+            STAT_ADD(downloads_ok, 1);
+        }
+    }
+}
+
+// 提交下载作业到任务队列，按文件大小选择优先级
+static bool dl_submit_job(const dl_job_t *job)
+{
+    QueueHandle_t queue = (job->size <= DL_SMALL_FILE_THRESHOLD) ?
+                          dl_job_queue_high : dl_job_queue_normal;
+
+    if (xQueueSend(queue, job, 10 / portTICK_PERIOD_MS) != pdTRUE) {
+        ESP_LOGW(TAG, "下载任务队列已满，丢弃作业: %s", job->filename);
+        return false;
+    }
+    return true;
+}
+
+// 初始化下载管理器：任务队列与工作任务池
+static esp_err_t dl_manager_init(void)
+{
+    dl_job_queue_high = xQueueCreate(DL_JOB_QUEUE_DEPTH, sizeof(dl_job_t));
+    dl_job_queue_normal = xQueueCreate(DL_JOB_QUEUE_DEPTH, sizeof(dl_job_t));
+    file_list_mutex = xSemaphoreCreateMutex();
+    http_pool_mutex = xSemaphoreCreateMutex();
+
+    if (dl_job_queue_high == NULL || dl_job_queue_normal == NULL || file_list_mutex == NULL) {
+        ESP_LOGE(TAG, "创建下载管理器队列失败");
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < DL_WORKER_COUNT; i++) {
+        char task_name[16];
+        snprintf(task_name, sizeof(task_name), "dl_worker%d", i);
+        if (xTaskCreatePinnedToCore(dl_worker_task, task_name, DL_WORKER_TASK_STACK_SIZE,
+                                    NULL, WS_TASK_PRIORITY - 1, NULL, CORE_WORK) != pdPASS) {
+            ESP_LOGE(TAG, "创建下载工作任务失败");
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+}
+
 // 修改WebSocket事件处理函数，只将事件放入队列
 static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -151,24 +625,22 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
     switch (event_id) {
     case WEBSOCKET_EVENT_CONNECTED:
         ESP_LOGI(TAG, "WebSocket连接成功");
-        // 直接处理连接事件
-        reconnect_attempts = 0;
+        // 直接处理连接事件，退避间隔复位
+        reconnect_backoff_ms = RECONNECT_BACKOFF_MIN_MS;
         if (reconnect_timer != NULL) {
             xTimerStop(reconnect_timer, portMAX_DELAY);
         }
         send_online_message();
-        xTimerStart(heartbeat_timer, portMAX_DELAY);
+        telemetry_enabled = true;
         break;
         
     case WEBSOCKET_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "WebSocket断开连接");
         // 直接处理断开连接事件
-        xTimerStop(heartbeat_timer, portMAX_DELAY);
+        telemetry_enabled = false;
         log_error_if_nonzero("HTTP状态码", data->error_handle.esp_ws_handshake_status_code);
         reset_connection_state();
-        if (reconnect_timer != NULL) {
-            xTimerStart(reconnect_timer, portMAX_DELAY);
-        }
+        schedule_reconnect();
         break;
         
     case WEBSOCKET_EVENT_DATA:
@@ -189,41 +661,101 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
         } else if (data->op_code == 0x8) { // close帧
             ESP_LOGW(TAG, "收到CLOSE帧");
             // 处理断开连接事件
-            xTimerStop(heartbeat_timer, portMAX_DELAY);
+            telemetry_enabled = false;
             reset_connection_state();
-            if (reconnect_timer != NULL) {
-                xTimerStart(reconnect_timer, portMAX_DELAY);
+            schedule_reconnect();
+            return;
+        }
+        
+        // 二进制帧按首字节标签分发，不经过JSON解析
+        if (data->op_code == 0x2 && data->data_len >= 1) {
+            uint8_t tag = (uint8_t)data->data_ptr[0];
+            if (tag == BIN_MSG_DOWNLOAD_NOTIFY && data->data_len == sizeof(bin_download_notify_t)) {
+                bin_download_notify_t notify;
+                memcpy(&notify, data->data_ptr, sizeof(notify));
+                notify.md5[sizeof(notify.md5) - 1] = '\0';
+                notify.sha256[sizeof(notify.sha256) - 1] = '\0';
+                notify.filename[sizeof(notify.filename) - 1] = '\0';
+                notify.url[sizeof(notify.url) - 1] = '\0';
+
+                dl_job_t job = {
+                    .has_md5 = (notify.md5[0] != '\0'),
+                    .has_sha256 = (notify.sha256[0] != '\0'),
+                    .size = notify.size,
+                };
+                strcpy(job.url, notify.url);
+                strcpy(job.filename, notify.filename);
+                strcpy(job.md5, notify.md5);
+                strcpy(job.sha256, notify.sha256);
+
+                if ((job.has_md5 || job.has_sha256) && job.size > 0) {
+                    ESP_LOGI(TAG, "收到二进制下载通知: %s, %d字节", job.filename, job.size);
+                    dl_submit_job(&job);
+                } else {
+                    ESP_LOGW(TAG, "二进制下载通知字段无效");
+                }
+            } else if (tag == BIN_MSG_ACK) {
+                ESP_LOGD(TAG, "收到二进制确认帧");
+            } else {
+                ESP_LOGW(TAG, "未知二进制帧标签: 0x%02x (len=%d)", tag, data->data_len);
             }
             return;
         }
         
-        ESP_LOGI(TAG, "收到数据: %.*s", data->data_len, (char *)data->data_ptr);
+        // 每帧格式化整个消息体曾是最热的日志点，降为异步紧凑记录
+        ALOG(LOG_SUBSYS_WS, ESP_LOG_DEBUG, "收到数据帧: %ld字节 (op=0x%lx)",
+             data->data_len, data->op_code);
         
-        // 为数据分配内存并复制
-        char *json_data = malloc(data->data_len + 1);
-        if (json_data == NULL) {
-            ESP_LOGE(TAG, "内存分配失败");
-            return;
+        STAT_ADD(ws_rx_messages, 1);
+        
+        // 从预分配的消息池申请槽位，热路径上不再malloc
+        rx_slot_t *slot = NULL;
+        char *json_data;
+        if (data->data_len < RX_POOL_SLOT_SIZE) {
+            slot = rx_pool_acquire();
+        }
+        if (slot != NULL) {
+            json_data = slot->data;
+        } else {
+            // 池耗尽或消息超过槽位容量时回退到堆分配
+            STAT_ADD(rx_pool_fallbacks, 1);
+            ESP_LOGW(TAG, "RX消息池不可用，回退到堆分配 (len=%d)", data->data_len);
+            json_data = malloc(data->data_len + 1);
+            if (json_data == NULL) {
+                STAT_ADD(alloc_failures, 1);
+                ESP_LOGE(TAG, "内存分配失败");
+                return;
+            }
         }
         
         memcpy(json_data, data->data_ptr, data->data_len);
         json_data[data->data_len] = '\0';
         
         // 先检查是否为简单确认消息，直接处理
-        const char* msg_type = get_message_type(json_data);
+        char type_buf[32];
+        const char* msg_type = get_message_type_r(json_data, type_buf, sizeof(type_buf));
         if (msg_type) {
-            if (strcmp(msg_type, "online_ack") == 0) {
-                ESP_LOGI(TAG, "设备上线确认");
-                send_file_list();
-                free(json_data);
-                return; // 直接处理完成，返回
-            } else if (strcmp(msg_type, "file_list_ack") == 0) {
-                ESP_LOGI(TAG, "文件列表确认");
-                free(json_data);
-                return; // 直接处理完成，返回
-            } else if (strcmp(msg_type, "heartbeat_ack") == 0) {
-                ESP_LOGD(TAG, "心跳确认");
-                free(json_data);
+            if (strcmp(msg_type, "online_ack") == 0 ||
+                strcmp(msg_type, "file_list_ack") == 0 ||
+                strcmp(msg_type, "heartbeat_ack") == 0) {
+                if (strcmp(msg_type, "online_ack") == 0) {
+                    ESP_LOGI(TAG, "设备上线确认");
+                    // 服务器支持二进制帧时启用协商模式
+                    binary_proto = (strstr(json_data, "\"binary\":true") != NULL);
+                    if (binary_proto) {
+                        ESP_LOGI(TAG, "已启用二进制帧协议");
+                    }
+                    send_file_list();
+                } else if (strcmp(msg_type, "file_list_ack") == 0) {
+                    ESP_LOGI(TAG, "文件列表确认");
+                } else {
+                    ESP_LOGD(TAG, "心跳确认");
+                }
+                if (slot != NULL) {
+                    rx_pool_release(slot);
+                } else {
+                    free(json_data);
+                }
                 return; // 直接处理完成，返回
             }
         }
@@ -232,13 +764,15 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
         ws_event_msg_t msg;
         msg.event_type = WS_EVENT_DATA;
         msg.data_info.data = json_data;
+        msg.data_info.slot = slot;
         msg.data_info.data_len = data->data_len;
         msg.data_info.op_code = data->op_code;
         
         // 将消息发送到队列，使用非阻塞方式（最多等待10 tick）
         if (xQueueSend(ws_event_queue, &msg, 10 / portTICK_PERIOD_MS) != pdTRUE) {
+            STAT_ADD(ws_queue_drops, 1);
             ESP_LOGW(TAG, "WebSocket事件队列已满，丢弃事件");
-            free(json_data);
+            ws_msg_release_data(&msg);
         }
         break;
         
@@ -273,9 +807,9 @@ static void ws_event_task(void *pvParameter)
             // 处理WebSocket事件
             handle_ws_event(&msg);
             
-            // 如果是数据事件，需要释放已分配的内存
+            // 如果是数据事件，归还池槽位（或释放回退路径的堆内存）
             if (msg.event_type == WS_EVENT_DATA) {
-                free(msg.data_info.data);
+                ws_msg_release_data(&msg);
             }
         }
     }
@@ -290,57 +824,136 @@ static void handle_ws_event(ws_event_msg_t *msg)
         char *json_data = msg->data_info.data;
         
         // 检查消息类型
-        const char* msg_type = get_message_type(json_data);
+        char type_buf[32];
+        const char* msg_type = get_message_type_r(json_data, type_buf, sizeof(type_buf));
         if (msg_type) {
-            ESP_LOGI(TAG, "任务处理消息类型: %s", msg_type);
+            ALOG(LOG_SUBSYS_WS, ESP_LOG_DEBUG, "任务处理消息 (长度%ld)", (long)strlen(json_data), 0);
             
-            // 处理下载通知（复杂消息）
+            // 处理下载通知（已知schema，用零分配提取器直接取字段）
             if (strcmp(msg_type, "download_notify") == 0) {
-                // 解析下载通知
-                cJSON *root = cJSON_Parse(json_data);
-                if (root) {
-                    cJSON *data_obj = cJSON_GetObjectItem(root, "data");
-                    if (data_obj) {
-                        char *filename = NULL;
-                        char *url = NULL;
-                        char *md5 = NULL;
-                        int size = 0;
-                        
-                        cJSON *json_filename = cJSON_GetObjectItem(data_obj, "filename");
-                        cJSON *json_url = cJSON_GetObjectItem(data_obj, "url");
-                        cJSON *json_md5 = cJSON_GetObjectItem(data_obj, "md5");
-                        cJSON *json_size = cJSON_GetObjectItem(data_obj, "size");
-                        
-                        if (json_filename && json_filename->valuestring) filename = json_filename->valuestring;
-                        if (json_url && json_url->valuestring) url = json_url->valuestring;
-                        if (json_md5 && json_md5->valuestring) md5 = json_md5->valuestring;
-                        if (json_size) size = json_size->valueint;
-                        
-                        if (filename && url && md5 && size > 0) {
-                            ESP_LOGI(TAG, "收到下载通知: 文件=%s, URL=%s, MD5=%s, 大小=%d", 
-                                    filename, url, md5, size);
-                            
-                            // 发送下载确认
-                            static char ack_buffer[256];
-                            snprintf(ack_buffer, sizeof(ack_buffer),
-                                    "{\"type\":\"download_ack\",\"status\":\"success\",\"message\":\"开始下载文件\",\"data\":{\"filename\":\"%s\"}}",
-                                    filename);
-                            
-                            ESP_LOGI(TAG, "发送下载确认: %s", ack_buffer);
-                            esp_websocket_client_send_text(client, ack_buffer, strlen(ack_buffer), portMAX_DELAY);
-                            
-                            // 开始下载文件
-                            esp_err_t ret = download_file(url, filename, md5, size);
-                            if (ret != ESP_OK) {
-                                ESP_LOGE(TAG, "文件下载失败");
-                            }
-                        } else {
-                            ESP_LOGE(TAG, "下载通知缺少必要字段");
+                char filename[64];
+                char url[192];
+                char md5[33];
+                char sha256[65];
+                int size = 0;
+                
+                bool has_filename = json_extract_string(json_data, "filename", filename, sizeof(filename));
+                bool has_url = json_extract_string(json_data, "url", url, sizeof(url));
+                bool has_md5 = json_extract_string(json_data, "md5", md5, sizeof(md5));
+                bool has_sha256 = json_extract_string(json_data, "sha256", sha256, sizeof(sha256));
+                bool has_size = json_extract_int(json_data, "size", &size);
+                
+                if (has_filename && has_url && (has_md5 || has_sha256) && has_size && size > 0) {
+                    ESP_LOGI(TAG, "收到下载通知: 文件=%s, URL=%s, %s=%s, 大小=%d", 
+                            filename, url, has_sha256 ? "SHA256" : "MD5",
+                            has_sha256 ? sha256 : md5, size);
+                    
+                    // 发送下载确认
+                    static char ack_buffer[256];
+                    snprintf(ack_buffer, sizeof(ack_buffer),
+                            "{\"type\":\"download_ack\",\"status\":\"success\",\"message\":\"开始下载文件\",\"data\":{\"filename\":\"%s\"}}",
+                            filename);
+                    
+                    ESP_LOGI(TAG, "发送下载确认: %s", ack_buffer);
+                    tx_enqueue_reliable(false, ack_buffer, strlen(ack_buffer));
+                    
+                    // 提交到下载管理器，由工作任务异步执行，不阻塞事件处理
+                    dl_job_t job = {
+                        .has_md5 = has_md5,
+                        .has_sha256 = has_sha256,
+                        .size = size,
+                    };
+                    strcpy(job.url, url);
+                    strcpy(job.filename, filename);
+                    if (has_md5) strcpy(job.md5, md5);
+                    if (has_sha256) strcpy(job.sha256, sha256);
+                    // 可选的传输编码协商：服务器压缩时携带content_encoding
+                    json_extract_string(json_data, "content_encoding",
+                                        job.content_encoding, sizeof(job.content_encoding));
+                    // 服务器的限速提示：群发错峰时按令牌桶整形下载速率
+                    json_extract_int(json_data, "rate_limit_kbps", &job.rate_limit_kbps);
+                    // 可选的组播群发会话
+                    job.has_mcast =
+                        json_extract_string(json_data, "mcast_group", job.mcast_group, sizeof(job.mcast_group)) &&
+                        json_extract_int(json_data, "mcast_port", &job.mcast_port) &&
+                        job.mcast_port > 0 && job.mcast_port < 65536;
+                    // 可选的增量补丁：patch_url+base_md5+patch_size齐全才启用
+                    job.has_patch =
+                        json_extract_string(json_data, "patch_url", job.patch_url, sizeof(job.patch_url)) &&
+                        json_extract_string(json_data, "base_md5", job.base_md5, sizeof(job.base_md5)) &&
+                        json_extract_int(json_data, "patch_size", &job.patch_size) &&
+                        job.patch_size > 0 && job.patch_size <= DL_PATCH_MAX_SIZE;
+                    dl_submit_job(&job);
+                } else {
+                    ESP_LOGE(TAG, "下载通知缺少必要字段");
+                }
+            } else if (strcmp(msg_type, "upload_request") == 0) {
+                // 上传请求同样走零分配提取路径
+                handle_upload_request(json_data);
+            } else if (strcmp(msg_type, "benchmark_request") == 0) {
+                // 启动基准测试任务，url字段可选（提供则测HTTP裸下载）
+                char bench_url[192];
+                char *url_copy = NULL;
+                if (json_extract_string(json_data, "url", bench_url, sizeof(bench_url))) {
+                    url_copy = strdup(bench_url);
+                }
+                if (xTaskCreatePinnedToCore(benchmark_task, "benchmark", BENCH_TASK_STACK_SIZE,
+                                            url_copy, TELEMETRY_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+                    ESP_LOGE(TAG, "创建基准测试任务失败");
+                    free(url_copy);
+                }
+            } else if (strcmp(msg_type, "stream_notify") == 0) {
+                // play-once内容直接流式播放，不落SPIFFS
+                char stream_url[192];
+                char stream_name[64];
+                int stream_size = 0;
+                if (json_extract_string(json_data, "url", stream_url, sizeof(stream_url)) &&
+                    json_extract_string(json_data, "filename", stream_name, sizeof(stream_name))) {
+                    json_extract_int(json_data, "size", &stream_size);
+                    if (stream_session_start(stream_url, stream_name, stream_size) == ESP_OK) {
+                        ESP_LOGI(TAG, "流式播放会话已启动: %s", stream_name);
+                    }
+                } else {
+                    ESP_LOGE(TAG, "流式播放通知缺少必要字段");
+                }
+            } else if (strcmp(msg_type, "log_config") == 0) {
+                // 运行期调整子系统日志级别: {"subsys":"transfer","level":3}
+                char subsys_name[16];
+                int level = ESP_LOG_INFO;
+                if (json_extract_string(json_data, "subsys", subsys_name, sizeof(subsys_name)) &&
+                    json_extract_int(json_data, "level", &level) &&
+                    level >= ESP_LOG_NONE && level <= ESP_LOG_VERBOSE) {
+                    if (strcmp(subsys_name, "transfer") == 0) {
+                        alog_subsys_level[LOG_SUBSYS_TRANSFER] = (uint8_t)level;
+                    } else if (strcmp(subsys_name, "ws") == 0) {
+                        alog_subsys_level[LOG_SUBSYS_WS] = (uint8_t)level;
+                    }
+                    ESP_LOGI(TAG, "日志级别已调整: %s -> %d", subsys_name, level);
+                }
+            } else if (strcmp(msg_type, "stats_request") == 0) {
+                // 服务器索取性能统计
+                send_stats();
+            } else if (strcmp(msg_type, "file_pin") == 0) {
+                // 服务器标记文件固定/可淘汰
+                char filename[32];
+                if (json_extract_string(json_data, "filename", filename, sizeof(filename))) {
+                    bool pinned = (strstr(json_data, "\"pinned\":true") != NULL);
+                    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+                    for (int i = 0; i < file_count; i++) {
+                        if (strcmp(device_files[i].filename, filename) == 0) {
+                            device_files[i].pinned = pinned ? 1 : 0;
+                            file_index_save();
+                            break;
                         }
                     }
-                    cJSON_Delete(root);
+                    xSemaphoreGive(file_list_mutex);
+                    ESP_LOGI(TAG, "文件%s已%s", filename, pinned ? "固定" : "取消固定");
                 }
-            } 
+            } else if (strcmp(msg_type, "download_complete_ack") == 0) {
+                ESP_LOGI(TAG, "下载完成确认");
+            } else if (strcmp(msg_type, "upload_complete_ack") == 0) {
+                ESP_LOGI(TAG, "上传完成确认");
+            }
             // 简单确认消息已在回调中处理，不需要在任务中再处理
         } else {
             // 处理其他复杂消息类型，尝试用cJSON解析
@@ -394,245 +1007,2212 @@ static void init_device_info(void)
 }
 
 
-// 发送设备上线消息
-static void send_online_message(void)
+// 实际发出一条出站消息，只有发送任务调用
+static void tx_send_raw(bool binary, const char *data, int len)
 {
-    // 使用静态缓冲区减少栈使用
-    static char json_buffer[256];
-    
-    // 直接格式化JSON字符串，避免使用cJSON库的动态内存分配
-    snprintf(json_buffer, sizeof(json_buffer),
-             "{\"type\":\"online\",\"data\":{\"version\":\"%s\",\"mac\":\"%s\"}}",
-             DEVICE_VERSION, device_mac);
-    
-    ESP_LOGI(TAG, "发送上线消息: %s", json_buffer);
-    
-    esp_websocket_client_send_text(client, json_buffer, strlen(json_buffer), portMAX_DELAY);
+    if (binary) {
+        esp_websocket_client_send_bin(client, data, len, portMAX_DELAY);
+    } else {
+        esp_websocket_client_send_text(client, data, len, portMAX_DELAY);
+    }
 }
 
-// 发送文件列表
-static void send_file_list(void)
+// 排队一条可靠消息（保序，队列满时短暂等待后丢弃并告警）。
+// 发送队列尚未创建时直接发送，覆盖启动早期的少量消息。
+static void tx_enqueue_reliable(bool binary, const char *data, int len)
 {
-    // 使用静态缓冲区减少栈使用
-    static char json_buffer[512];
-    static char files_buffer[384]; // 用于存储文件数组部分
-    
-    // 先构建文件数组部分
-    files_buffer[0] = '\0';
-    for (int i = 0; i < file_count; i++) {
-        char file_json[128];
-        snprintf(file_json, sizeof(file_json),
-                "%s{\"filename\":\"%s\",\"size\":%d,\"md5\":\"%s\",\"timestamp\":%lld}",
-                (i > 0 ? "," : ""), 
-                device_files[i].filename, 
-                device_files[i].size,
-                device_files[i].md5,
-                device_files[i].timestamp);
-        
-        // 确保不会缓冲区溢出
-        if (strlen(files_buffer) + strlen(file_json) < sizeof(files_buffer) - 1) {
-            strcat(files_buffer, file_json);
-        } else {
-            ESP_LOGW(TAG, "文件列表过长，已截断");
+    if (tx_reliable_queue == NULL) {
+        tx_send_raw(binary, data, len);
+        return;
+    }
+    if (len > TX_MSG_MAX_LEN) {
+        ESP_LOGE(TAG, "出站消息过长: %d字节", len);
+        return;
+    }
+
+    tx_msg_t *msg = malloc(sizeof(tx_msg_t) + len);
+    if (msg == NULL) {
+        return;
+    }
+    msg->binary = binary;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+
+    if (xQueueSend(tx_reliable_queue, &msg, TX_ENQUEUE_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+        ESP_LOGW(TAG, "出站队列已满，丢弃消息");
+        free(msg);
+    }
+}
+
+// 排队一条进度消息：同文件名的旧进度被新进度覆盖，不堆积
+static void tx_enqueue_progress(const char *filename, bool binary, const char *data, int len)
+{
+    if (tx_progress_mutex == NULL || len > sizeof(tx_progress_slots[0].payload)) {
+        tx_send_raw(binary, data, len);
+        return;
+    }
+
+    xSemaphoreTake(tx_progress_mutex, portMAX_DELAY);
+    tx_progress_slot_t *slot = NULL;
+    for (int i = 0; i < TX_PROGRESS_SLOTS; i++) {
+        if (tx_progress_slots[i].valid &&
+            strcmp(tx_progress_slots[i].filename, filename) == 0) {
+            slot = &tx_progress_slots[i]; // 覆盖同文件的旧进度
             break;
         }
+        if (slot == NULL && !tx_progress_slots[i].valid) {
+            slot = &tx_progress_slots[i];
+        }
     }
-    
-    // 构建完整JSON
-    snprintf(json_buffer, sizeof(json_buffer),
-             "{\"type\":\"file_list\",\"data\":{\"files\":[%s]}}",
-             files_buffer);
-    
-    ESP_LOGI(TAG, "发送文件列表: %s", json_buffer);
-    
-    esp_websocket_client_send_text(client, json_buffer, strlen(json_buffer), portMAX_DELAY);
+    if (slot == NULL) {
+        slot = &tx_progress_slots[0]; // 槽全满：牺牲最老的槽，进度本就允许丢
+    }
+    slot->valid = true;
+    slot->binary = binary;
+    strncpy(slot->filename, filename, sizeof(slot->filename) - 1);
+    slot->filename[sizeof(slot->filename) - 1] = '\0';
+    slot->len = len;
+    memcpy(slot->payload, data, len);
+    xSemaphoreGive(tx_progress_mutex);
 }
 
-// 心跳定时器回调
-static void heartbeat_timer_callback(TimerHandle_t xTimer)
+// 出站发送任务：可靠消息优先并保序，随后冲洗进度合并槽。
+// 发送阻塞只发生在这里，传输循环永远不等radio。
+static void tx_sender_task(void *pvParameter)
 {
-    // 简化心跳发送过程，减少栈使用
-    static char heartbeat_msg[64];
-    int64_t timestamp = esp_timer_get_time() / 1000000; // 当前时间（秒）
-    
-    snprintf(heartbeat_msg, sizeof(heartbeat_msg), 
-             "{\"type\":\"heartbeat\",\"timestamp\":%lld}", timestamp);
-    
-    ESP_LOGD(TAG, "发送心跳");
-    esp_websocket_client_send_text(client, heartbeat_msg, strlen(heartbeat_msg), 0);
+    while (1) {
+        tx_msg_t *msg = NULL;
+        if (xQueueReceive(tx_reliable_queue, &msg, 50 / portTICK_PERIOD_MS) == pdTRUE) {
+            tx_send_raw(msg->binary, msg->data, msg->len);
+            free(msg);
+        }
+
+        // 把有效槽内容拷出后立刻释放锁，发送期间不挡进度更新
+        for (int i = 0; i < TX_PROGRESS_SLOTS; i++) {
+            tx_progress_slot_t snapshot;
+            xSemaphoreTake(tx_progress_mutex, portMAX_DELAY);
+            bool valid = tx_progress_slots[i].valid;
+            if (valid) {
+                snapshot = tx_progress_slots[i];
+                tx_progress_slots[i].valid = false;
+            }
+            xSemaphoreGive(tx_progress_mutex);
+            if (valid) {
+                tx_send_raw(snapshot.binary, snapshot.payload, snapshot.len);
+            }
+        }
+    }
 }
 
-// 重连定时器回调
-static void reconnect_timer_callback(TimerHandle_t xTimer)
+// 异步日志排空任务：批量把环形缓冲里的记录格式化到UART
+static void alog_drain_task(void *pvParameter)
 {
-    attempt_reconnect();
+    char line[128];
+
+    while (1) {
+        uint32_t head = __atomic_load_n(&alog_head, __ATOMIC_RELAXED);
+        while (alog_tail != head) {
+            alog_record_t *rec = &alog_ring[alog_tail & (ALOG_RING_SIZE - 1)];
+            if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != alog_tail + 1) {
+                break; // 生产者已占槽但还没写完，下一轮再收
+            }
+            snprintf(line, sizeof(line), rec->fmt, rec->arg1, rec->arg2);
+            switch (rec->level) {
+                case ESP_LOG_ERROR: ESP_LOGE(TAG, "%s", line); break;
+                case ESP_LOG_WARN:  ESP_LOGW(TAG, "%s", line); break;
+                case ESP_LOG_DEBUG: ESP_LOGD(TAG, "%s", line); break;
+                default:            ESP_LOGI(TAG, "%s", line); break;
+            }
+            alog_tail++;
+        }
+
+        uint32_t dropped = __atomic_exchange_n(&alog_dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0) {
+            ESP_LOGW(TAG, "异步日志环满，丢弃%lu条记录", (unsigned long)dropped);
+        }
+        vTaskDelay(ALOG_DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+    }
 }
 
-// 复位连接状态
-static void reset_connection_state(void)
+// 流式播放会话：play-once类内容不落SPIFFS，HTTP数据经PSRAM环形缓冲
+// 直接送给音频落地回调，省掉一次flash写+读和对应的磨损。
+// 环形缓冲写满即是高水位——生产者在xRingbufferSend上自然阻塞；
+// 消费者在预缓冲水位达到前不起播，避免开头就欠载。
+typedef struct {
+    char url[192];               // 音频流URL
+    char filename[64];           // 用于进度上报的名称
+    int size;                    // 预期字节数（可为0表示未知）
+    RingbufHandle_t ring;        // 字节环形缓冲
+    char *ring_storage;          // 环形缓冲存储区（PSRAM）
+    volatile bool producer_done; // HTTP读取是否结束
+    volatile bool producer_failed; // 生产任务未能创建，会话资源改由消费任务回收
+    esp_err_t producer_result;   // 读取侧结果
+    SemaphoreHandle_t prebuffer_sem; // 预缓冲就绪信号
+    SemaphoreHandle_t done_sem;      // 消费者完成信号
+    StaticRingbuffer_t ring_struct;  // 环形缓冲控制块（随会话分配，支持并发会话）
+} stream_session_t;
+
+// 音频落地回调：真正的播放驱动（I2S/解码器）在此接入，按播放
+// 速率消费并返回已接受的字节数。默认实现只消费并计数，便于在
+// 没有音频外设的板卡上验证整条流水线。
+typedef int (*stream_sink_fn)(const char *data, int len);
+
+static int stream_sink_default(const char *data, int len)
 {
-    // 复位所有与连接相关的状态
-    // 可以在此添加任何需要在断开连接时重置的状态
-    ESP_LOGI(TAG, "正在复位连接状态");
+    (void)data;
+    return len;
 }
 
-// 尝试重连
-static void attempt_reconnect(void)
+static stream_sink_fn stream_sink = stream_sink_default;
+
+// 流式播放消费任务：预缓冲就绪后从环形缓冲取数据喂给落地回调
+static void stream_playback_task(void *pvParameter)
 {
-    if (reconnect_attempts < MAX_RECONNECT_ATTEMPTS) {
-        reconnect_attempts++;
-        ESP_LOGI(TAG, "尝试重连 (%d/%d)...", reconnect_attempts, MAX_RECONNECT_ATTEMPTS);
-        
-        // 如果客户端已停止，则重新启动
-        if (client != NULL && !esp_websocket_client_is_connected(client)) {
-            ESP_LOGI(TAG, "正在重新连接到WebSocket服务器...");
-            esp_websocket_client_start(client);
+    stream_session_t *session = (stream_session_t *)pvParameter;
+    int consumed = 0;
+
+    // 等预缓冲达到水位（或生产者提前结束）再起播
+    xSemaphoreTake(session->prebuffer_sem, portMAX_DELAY);
+    ESP_LOGI(TAG, "流式播放开始: %s", session->filename);
+
+    while (1) {
+        size_t item_len = 0;
+        char *item = xRingbufferReceiveUpTo(session->ring, &item_len,
+                                            100 / portTICK_PERIOD_MS, STREAM_CHUNK_SIZE);
+        if (item == NULL) {
+            if (session->producer_done) {
+                break;
+            }
+            continue; // 欠载：等生产者补数据
         }
-    } else {
-        ESP_LOGW(TAG, "达到最大重连尝试次数 (%d)，停止重连", MAX_RECONNECT_ATTEMPTS);
-        xTimerStop(reconnect_timer, portMAX_DELAY);
-        // 可以在此添加其他失败处理逻辑，如重启设备等
+
+        int accepted = 0;
+        while (accepted < item_len) {
+            int n = stream_sink(item + accepted, item_len - accepted);
+            if (n <= 0) {
+                break;
+            }
+            accepted += n;
+        }
+        vRingbufferReturnItem(session->ring, item);
+        consumed += item_len;
+    }
+
+    ESP_LOGI(TAG, "流式播放结束: %s, 消费%d字节", session->filename, consumed);
+    if (session->producer_failed) {
+        // 生产任务没起来，没人等done_sem，会话资源在这里回收
+        vRingbufferDelete(session->ring);
+        free(session->ring_storage);
+        vSemaphoreDelete(session->prebuffer_sem);
+        vSemaphoreDelete(session->done_sem);
+        free(session);
+        vTaskDelete(NULL);
     }
+    xSemaphoreGive(session->done_sem);
+    vTaskDelete(NULL);
 }
 
-// HTTP事件处理函数
-static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+// 流式播放生产任务：HTTP读取直接写入环形缓冲，随后回收整个会话
+static void stream_download_task(void *pvParameter)
 {
-    static int file_size = 0;
-    static char *file_buffer = NULL;
-    static int received_size = 0;
-    
-    switch(evt->event_id) {
-        case HTTP_EVENT_ON_HEADER:
-            if (strcmp(evt->header_key, "Content-Length") == 0) {
-                file_size = atoi(evt->header_value);
-                ESP_LOGI(TAG, "文件大小: %d", file_size);
-                
-                // 分配内存用于存储文件
-                if (file_buffer) {
-                    free(file_buffer);
-                }
-                file_buffer = malloc(file_size);
-                if (!file_buffer) {
-                    ESP_LOGE(TAG, "内存分配失败");
-                    return ESP_FAIL;
-                }
-                received_size = 0;
-            }
-            break;
-            
-        case HTTP_EVENT_ON_DATA:
-            if (file_buffer) {
-                if (received_size + evt->data_len <= file_size) {
-                    memcpy(file_buffer + received_size, evt->data, evt->data_len);
-                    received_size += evt->data_len;
+    stream_session_t *session = (stream_session_t *)pvParameter;
+    int total_read = 0;
+    bool prebuffer_signaled = false;
+
+    esp_http_client_handle_t http_client = http_pool_acquire(session->url);
+    if (http_client != NULL) {
+        esp_err_t err = esp_http_client_open(http_client, 0);
+        if (err == ESP_OK) {
+            esp_http_client_fetch_headers(http_client);
+            char *chunk = malloc(STREAM_CHUNK_SIZE);
+            if (chunk != NULL) {
+                while (1) {
+                    int read_len = esp_http_client_read(http_client, chunk, STREAM_CHUNK_SIZE);
+                    if (read_len <= 0) {
+                        break;
+                    }
+                    // 环形缓冲满即阻塞，播放速率反压HTTP读取
+                    xRingbufferSend(session->ring, chunk, read_len, portMAX_DELAY);
+                    total_read += read_len;
+                    STAT_ADD(bytes_downloaded, read_len);
+
+                    if (!prebuffer_signaled && total_read >= STREAM_PREBUFFER) {
+                        xSemaphoreGive(session->prebuffer_sem);
+                        prebuffer_signaled = true;
+                    }
                 }
+                free(chunk);
             }
-            break;
-            
-        case HTTP_EVENT_ON_FINISH:
-            if (file_buffer && received_size == file_size) {
-                ESP_LOGI(TAG, "文件下载完成，大小: %d", received_size);
-                
-                // 在HTTP_EVENT_ON_FINISH中，可以处理下载的文件
-                // 但具体操作应该在download_file函数中完成
-            }
-            break;
-            
+            int status_code = esp_http_client_get_status_code(http_client);
+            session->producer_result =
+                (status_code == 200 && (session->size == 0 || total_read == session->size))
+                ? ESP_OK : ESP_FAIL;
+            http_pool_release(http_client, session->producer_result == ESP_OK);
+        } else {
+            ESP_LOGE(TAG, "流式HTTP请求失败: %s", esp_err_to_name(err));
+            session->producer_result = err;
+            http_pool_release(http_client, false);
+        }
+    } else {
+        session->producer_result = ESP_FAIL;
+    }
+
+    session->producer_done = true;
+    if (!prebuffer_signaled) {
+        // 短内容或失败：直接放行消费者，让它把已有数据播完并退出
+        xSemaphoreGive(session->prebuffer_sem);
+    }
+
+    // 等消费者播完再回收会话资源
+    xSemaphoreTake(session->done_sem, portMAX_DELAY);
+
+    // 上报流式播放结果
+    static char json_buffer[192];
+    snprintf(json_buffer, sizeof(json_buffer),
+             "{\"type\":\"stream_complete\",\"status\":\"%s\",\"data\":{\"filename\":\"%s\",\"bytes\":%d}}",
+             session->producer_result == ESP_OK ? "success" : "error",
+             session->filename, total_read);
+    ESP_LOGI(TAG, "发送流式播放结果: %s", json_buffer);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+
+    vRingbufferDelete(session->ring);
+    free(session->ring_storage);
+    vSemaphoreDelete(session->prebuffer_sem);
+    vSemaphoreDelete(session->done_sem);
+    free(session);
+    vTaskDelete(NULL);
+}
+
+// 启动流式播放会话：分配PSRAM环形缓冲并拉起生产/消费任务对
+static esp_err_t stream_session_start(const char *url, const char *filename, int size)
+{
+    stream_session_t *session = calloc(1, sizeof(stream_session_t));
+    if (session == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // 环形缓冲存储区必须放PSRAM，128KB不适合占用内部RAM
+    session->ring_storage = heap_caps_malloc(STREAM_RING_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (session->ring_storage != NULL) {
+        session->ring = xRingbufferCreateStatic(STREAM_RING_SIZE, RINGBUF_TYPE_BYTEBUF,
+                                                (uint8_t *)session->ring_storage,
+                                                &session->ring_struct);
+    }
+    session->prebuffer_sem = xSemaphoreCreateBinary();
+    session->done_sem = xSemaphoreCreateBinary();
+
+    if (session->ring == NULL || session->prebuffer_sem == NULL || session->done_sem == NULL) {
+        ESP_LOGE(TAG, "流式播放需要PSRAM环形缓冲，创建失败");
+        if (session->ring) vRingbufferDelete(session->ring);
+        free(session->ring_storage);
+        if (session->prebuffer_sem) vSemaphoreDelete(session->prebuffer_sem);
+        if (session->done_sem) vSemaphoreDelete(session->done_sem);
+        free(session);
+        return ESP_ERR_NO_MEM;
+    }
+
+    strncpy(session->url, url, sizeof(session->url) - 1);
+    strncpy(session->filename, filename, sizeof(session->filename) - 1);
+    session->size = size;
+    session->producer_result = ESP_FAIL;
+
+    // 生产者在网络核，消费者与音频/flash类负载同在工作核
+    if (xTaskCreatePinnedToCore(stream_playback_task, "stream_play", STREAM_TASK_STACK_SIZE,
+                                session, WS_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+        // 两个任务都还没起来，直接原地回收
+        ESP_LOGE(TAG, "创建流式播放任务失败");
+        vRingbufferDelete(session->ring);
+        free(session->ring_storage);
+        vSemaphoreDelete(session->prebuffer_sem);
+        vSemaphoreDelete(session->done_sem);
+        free(session);
+        return ESP_FAIL;
+    }
+    if (xTaskCreatePinnedToCore(stream_download_task, "stream_dl", STREAM_TASK_STACK_SIZE,
+                                session, WS_TASK_PRIORITY, NULL, CORE_NET) != pdPASS) {
+        // 消费者已启动：标记生产者缺席并放行，会话资源由消费任务回收
+        ESP_LOGE(TAG, "创建流式下载任务失败");
+        session->producer_failed = true;
+        session->producer_done = true;
+        xSemaphoreGive(session->prebuffer_sem);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// 发送设备上线消息
+static void send_online_message(void)
+{
+    // 使用静态缓冲区减少栈使用
+    static char json_buffer[256];
+    
+    // 直接格式化JSON字符串，避免使用cJSON库的动态内存分配
+    snprintf(json_buffer, sizeof(json_buffer),
+             "{\"type\":\"online\",\"data\":{\"version\":\"%s\",\"mac\":\"%s\","
+             "\"protocols\":[\"json\",\"binary\"]}}",
+             DEVICE_VERSION, device_mac);
+    
+    ESP_LOGI(TAG, "发送上线消息: %s", json_buffer);
+    
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+}
+
+// 格式化单个文件条目到缓冲区指定偏移，返回写入后的新偏移。
+// snprintf返回的是期望长度，截断时会超过剩余空间，这里夹回缓冲区内，
+// 保证返回值始终可以继续作为写入偏移使用
+static int format_file_entry(char *buf, int off, int buf_size, const file_info_t *info, bool first)
+{
+    off += snprintf(buf + off, buf_size - off,
+                    "%s{\"filename\":\"%s\",\"size\":%d,\"md5\":\"%s\",\"timestamp\":%lld,\"active\":%d}",
+                    first ? "" : ",",
+                    info->filename, info->size, info->md5, info->timestamp,
+                    info->active);
+    if (off > buf_size - 1) {
+        off = buf_size - 1;
+    }
+    return off;
+}
+
+// 发送文件列表：分页发送，每帧携带序号与总帧数，任意大小的清单都放得下
+// 写入使用游标偏移而非strcat，避免随清单长度二次增长
+static void send_file_list(void)
+{
+    // 使用静态缓冲区减少栈使用
+    static char json_buffer[1024];
+
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+
+    // 空清单也要发一帧，让服务器知道设备状态
+    int total_chunks = (file_count + FILE_LIST_CHUNK_ENTRIES - 1) / FILE_LIST_CHUNK_ENTRIES;
+    if (total_chunks == 0) {
+        total_chunks = 1;
+    }
+
+    for (int seq = 0; seq < total_chunks; seq++) {
+        int off = snprintf(json_buffer, sizeof(json_buffer),
+                           "{\"type\":\"file_list\",\"data\":{\"seq\":%d,\"total_chunks\":%d,\"files\":[",
+                           seq, total_chunks);
+
+        int start = seq * FILE_LIST_CHUNK_ENTRIES;
+        int end = start + FILE_LIST_CHUNK_ENTRIES;
+        if (end > file_count) {
+            end = file_count;
+        }
+
+        for (int i = start; i < end; i++) {
+            off = format_file_entry(json_buffer, off, sizeof(json_buffer),
+                                    &device_files[i], i == start);
+            if (off >= (int)sizeof(json_buffer) - 1) {
+                ESP_LOGE(TAG, "file_list帧溢出，条目过大");
+                break;
+            }
+        }
+
+        off += snprintf(json_buffer + off, sizeof(json_buffer) - off, "]}}");
+
+        ESP_LOGI(TAG, "发送文件列表帧 %d/%d: %s", seq + 1, total_chunks, json_buffer);
+        tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+    }
+
+    xSemaphoreGive(file_list_mutex);
+}
+
+// 发送文件列表增量：下载完成后只上报变化的条目，不重发完整清单
+static void send_file_list_delta(const file_info_t *info)
+{
+    static char json_buffer[256];
+
+    int off = snprintf(json_buffer, sizeof(json_buffer),
+                       "{\"type\":\"file_list_delta\",\"data\":{\"files\":[");
+    off = format_file_entry(json_buffer, off, sizeof(json_buffer), info, true);
+    snprintf(json_buffer + off, sizeof(json_buffer) - off, "]}}");
+
+    ESP_LOGI(TAG, "发送文件列表增量: %s", json_buffer);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+}
+
+// 心跳与遥测任务：低优先级任务按固定周期把心跳和周期性遥测
+// （堆水位、RSSI、SPIFFS剩余空间）合并成一帧发送。
+// 之前心跳在FreeRTOS定时器服务任务里发送，WS发送队列阻塞时会拖住
+// 系统里所有其他定时器，定时器服务任务栈也被迫加大到8192。
+static void telemetry_task(void *pvParameter)
+{
+    static char telemetry_msg[256];
+
+    while (1) {
+        vTaskDelay(HEARTBEAT_INTERVAL_SEC * 1000 / portTICK_PERIOD_MS);
+
+        // 断开连接期间不发送
+        if (!telemetry_enabled) {
+            continue;
+        }
+
+        int64_t timestamp = esp_timer_get_time() / 1000000; // 当前时间（秒）
+
+        // 采集遥测数据
+        int rssi = 0;
+        wifi_ap_record_t ap_info;
+        if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+            rssi = ap_info.rssi;
+        }
+
+        size_t spiffs_total = 0, spiffs_used = 0;
+        esp_spiffs_info("spiffs", &spiffs_total, &spiffs_used);
+
+        // 二进制模式下16字节的打包结构体即可携带全部遥测
+        if (binary_proto) {
+            bin_heartbeat_t frame = {
+                .tag = BIN_MSG_HEARTBEAT,
+                .timestamp = timestamp,
+                .free_heap = esp_get_free_heap_size(),
+                .rssi = (int8_t)rssi,
+                .spiffs_free_kb = (uint16_t)((spiffs_total - spiffs_used) / 1024),
+            };
+            tx_enqueue_reliable(true, (const char *)&frame, sizeof(frame));
+            continue;
+        }
+
+        // 心跳与遥测合并成一帧，每周期只唤醒一次射频
+        snprintf(telemetry_msg, sizeof(telemetry_msg),
+                 "{\"type\":\"heartbeat\",\"timestamp\":%lld,"
+                 "\"telemetry\":{\"free_heap\":%lu,\"min_free_heap\":%lu,"
+                 "\"rssi\":%d,\"spiffs_free\":%u,"
+                 "\"bytes_downloaded\":%lu,\"ws_queue_drops\":%lu}}",
+                 timestamp,
+                 (unsigned long)esp_get_free_heap_size(),
+                 (unsigned long)esp_get_minimum_free_heap_size(),
+                 rssi,
+                 spiffs_total - spiffs_used,
+                 (unsigned long)perf_stats.bytes_downloaded,
+                 (unsigned long)perf_stats.ws_queue_drops);
+
+        ESP_LOGD(TAG, "发送心跳遥测帧");
+        tx_enqueue_reliable(false, telemetry_msg, strlen(telemetry_msg));
+    }
+}
+
+// 重连定时器回调：单次触发，到期即尝试重连
+// 下一次调度完全由断开事件驱动，空闲时没有周期性唤醒
+static void reconnect_timer_callback(TimerHandle_t xTimer)
+{
+    if (client != NULL && !esp_websocket_client_is_connected(client)) {
+        ESP_LOGI(TAG, "正在重新连接到WebSocket服务器...");
+        esp_websocket_client_start(client);
+    }
+}
+
+// 复位连接状态
+static void reset_connection_state(void)
+{
+    // 复位所有与连接相关的状态
+    // 可以在此添加任何需要在断开连接时重置的状态
+    ESP_LOGI(TAG, "正在复位连接状态");
+}
+
+// 按指数退避+随机抖动调度下一次重连：间隔从1秒逐步翻倍到60秒，
+// 不设尝试次数上限——之前打满10次后设备会永久离线直到人工断电重启。
+// 抖动避免大批设备在AP恢复后同时发起连接。
+static void schedule_reconnect(void)
+{
+    if (reconnect_timer == NULL) {
+        return;
+    }
+
+    // 0~25%的随机抖动
+    uint32_t jitter = esp_random() % (reconnect_backoff_ms / 4 + 1);
+    uint32_t delay_ms = reconnect_backoff_ms + jitter;
+
+    ESP_LOGI(TAG, "%lu毫秒后尝试重连", (unsigned long)delay_ms);
+    xTimerChangePeriod(reconnect_timer, delay_ms / portTICK_PERIOD_MS, portMAX_DELAY);
+
+    // 下次断开时的退避间隔翻倍，封顶60秒
+    reconnect_backoff_ms *= 2;
+    if (reconnect_backoff_ms > RECONNECT_BACKOFF_MAX_MS) {
+        reconnect_backoff_ms = RECONNECT_BACKOFF_MAX_MS;
+    }
+}
+
+// HTTP事件处理函数。下载数据由download_file自己的esp_http_client_read
+// 循环直接送入流水线，这里不做任何缓冲——早期版本曾按Content-Length
+// 整块malloc并逐块memcpy，每次下载凭空多出最高1MB的堆峰值和一次
+// 全量内存拷贝，且非DISCONNECTED路径上还会泄漏。
+static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+{
+    switch(evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGD(TAG, "HTTP传输错误");
+            break;
+
         case HTTP_EVENT_DISCONNECTED:
-            if (file_buffer) {
-                free(file_buffer);
-                file_buffer = NULL;
+            ESP_LOGD(TAG, "HTTP连接断开");
+            break;
+
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+// 从URL中解析主机与端口，成功返回true
+static bool http_pool_parse_host(const char *url, char *host, size_t host_size, int *port)
+{
+    const char *p = strstr(url, "://");
+    if (p == NULL) {
+        return false;
+    }
+    *port = (strncmp(url, "https", 5) == 0) ? 443 : 80;
+    p += 3;
+    const char *end = p;
+    while (*end != '\0' && *end != '/' && *end != ':') {
+        end++;
+    }
+    if (end == p || (size_t)(end - p) >= host_size) {
+        return false;
+    }
+    memcpy(host, p, end - p);
+    host[end - p] = '\0';
+    if (*end == ':') {
+        *port = atoi(end + 1);
+    }
+    return true;
+}
+
+// 从连接池取一个客户端：同主机的空闲连接直接复用，否则新建并登记。
+// 拿到的句柄用http_pool_release归还，不要直接esp_http_client_cleanup。
+static esp_http_client_handle_t http_pool_acquire(const char *url)
+{
+    char host[64];
+    int port = 0;
+    bool poolable = http_pool_parse_host(url, host, sizeof(host), &port);
+
+    if (poolable && http_pool_mutex != NULL) {
+        xSemaphoreTake(http_pool_mutex, portMAX_DELAY);
+        int64_t now = esp_timer_get_time() / 1000000;
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            http_pool_entry_t *entry = &http_pool[i];
+            if (entry->client == NULL || entry->in_use) {
+                continue;
+            }
+            if (now - entry->last_used > HTTP_POOL_IDLE_TIMEOUT_SEC) {
+                // 空闲超时的连接服务器多半已经关了，直接丢弃
+                esp_http_client_cleanup(entry->client);
+                entry->client = NULL;
+                continue;
+            }
+            if (strcmp(entry->host, host) == 0 && entry->port == port) {
+                entry->in_use = true;
+                xSemaphoreGive(http_pool_mutex);
+                esp_http_client_set_url(entry->client, url);
+                ESP_LOGD(TAG, "复用到%s:%d的持久连接", host, port);
+                return entry->client;
+            }
+        }
+        xSemaphoreGive(http_pool_mutex);
+    }
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .event_handler = http_event_handler,
+        .timeout_ms = 10000,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t new_client = esp_http_client_init(&config);
+    if (new_client == NULL) {
+        return NULL;
+    }
+
+    if (poolable && http_pool_mutex != NULL) {
+        // 登记到空槽；没有空槽时淘汰最久未用的空闲连接
+        xSemaphoreTake(http_pool_mutex, portMAX_DELAY);
+        int slot = -1;
+        int64_t oldest = INT64_MAX;
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            if (http_pool[i].client == NULL) {
+                slot = i;
+                break;
+            }
+            if (!http_pool[i].in_use && http_pool[i].last_used < oldest) {
+                oldest = http_pool[i].last_used;
+                slot = i;
+            }
+        }
+        if (slot >= 0) {
+            if (http_pool[slot].client != NULL) {
+                esp_http_client_cleanup(http_pool[slot].client);
+            }
+            http_pool[slot].client = new_client;
+            strncpy(http_pool[slot].host, host, sizeof(http_pool[slot].host) - 1);
+            http_pool[slot].host[sizeof(http_pool[slot].host) - 1] = '\0';
+            http_pool[slot].port = port;
+            http_pool[slot].in_use = true;
+        }
+        xSemaphoreGive(http_pool_mutex);
+    }
+    return new_client;
+}
+
+// 归还连接。reusable为true且响应体已读完时连接留在池里保持存活，
+// 否则销毁——半读的响应体会污染下一次复用。
+static void http_pool_release(esp_http_client_handle_t pooled, bool reusable)
+{
+    if (pooled == NULL) {
+        return;
+    }
+    if (http_pool_mutex != NULL) {
+        xSemaphoreTake(http_pool_mutex, portMAX_DELAY);
+        for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+            if (http_pool[i].client == pooled) {
+                if (reusable) {
+                    // 清掉本次请求设置的专用头，续传的Range或上传的
+                    // Content-*带到下一次复用会拿到残缺响应或被服务器拒绝
+                    esp_http_client_delete_header(pooled, "Range");
+                    esp_http_client_delete_header(pooled, "Content-Type");
+                    esp_http_client_delete_header(pooled, "Content-Length");
+                    esp_http_client_delete_header(pooled, "X-Filename");
+                    http_pool[i].in_use = false;
+                    http_pool[i].last_used = esp_timer_get_time() / 1000000;
+                } else {
+                    esp_http_client_cleanup(pooled);
+                    http_pool[i].client = NULL;
+                }
+                xSemaphoreGive(http_pool_mutex);
+                return;
+            }
+        }
+        xSemaphoreGive(http_pool_mutex);
+    }
+    // 未入池的连接直接销毁
+    esp_http_client_cleanup(pooled);
+}
+
+// 确保索引数组有至少needed个条目的容量
+static bool file_index_reserve(int needed)
+{
+    if (needed <= file_capacity) {
+        return true;
+    }
+
+    // 上限同时挡住倍增循环的int溢出和荒谬的realloc请求
+    if (needed > FILE_INDEX_MAX_ENTRIES) {
+        ESP_LOGE(TAG, "文件索引条目数超出上限: %d", needed);
+        return false;
+    }
+
+    int new_capacity = (file_capacity > 0) ? file_capacity * 2 : FILE_INDEX_INITIAL_CAPACITY;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > FILE_INDEX_MAX_ENTRIES) {
+        new_capacity = FILE_INDEX_MAX_ENTRIES;
+    }
+
+    file_info_t *new_files = realloc(device_files, new_capacity * sizeof(file_info_t));
+    if (new_files == NULL) {
+        ESP_LOGE(TAG, "文件索引扩容失败");
+        return false;
+    }
+
+    device_files = new_files;
+    file_capacity = new_capacity;
+    return true;
+}
+
+// 从SPIFFS加载持久化文件索引
+static esp_err_t file_index_load(void)
+{
+    FILE *f = fopen(FILE_INDEX_PATH, "rb");
+    if (f == NULL) {
+        // 首次启动没有索引是正常情况
+        ESP_LOGI(TAG, "未找到文件索引，从空清单开始");
+        return ESP_OK;
+    }
+
+    file_index_header_t header;
+    bool valid = fread(&header, 1, sizeof(header), f) == sizeof(header) &&
+                 header.magic == FILE_INDEX_MAGIC && header.count >= 0;
+
+    // count必须与索引文件实际大小吻合：魔数侥幸存活而count是垃圾时，
+    // 拿它去扩容会触发巨大的realloc，失败沿init_spiffs传到
+    // ESP_ERROR_CHECK就成了每次启动都复现的panic
+    if (valid) {
+        fseek(f, 0, SEEK_END);
+        long data_bytes = ftell(f) - (long)sizeof(header);
+        valid = data_bytes >= 0 && header.count <= data_bytes / (long)sizeof(file_info_t);
+        fseek(f, sizeof(header), SEEK_SET);
+    }
+
+    // 任何加载失败（含扩容失败）都按损坏索引处理：删掉重来，
+    // 启动绝不因为一个坏索引文件变成致命错误
+    if (!valid || !file_index_reserve(header.count)) {
+        ESP_LOGW(TAG, "文件索引损坏，重建空清单");
+        fclose(f);
+        unlink(FILE_INDEX_PATH);
+        return ESP_OK;
+    }
+
+    int loaded = fread(device_files, sizeof(file_info_t), header.count, f);
+    fclose(f);
+
+    if (loaded != header.count) {
+        ESP_LOGW(TAG, "文件索引记录不完整: %d/%d", loaded, header.count);
+    }
+    file_count = loaded;
+
+    ESP_LOGI(TAG, "已加载文件索引: %d个文件", file_count);
+    return ESP_OK;
+}
+
+// 保存文件索引到SPIFFS：先写临时文件再改名，避免掉电留下半截索引
+// 调用方需持有file_list_mutex
+static void file_index_save(void)
+{
+    FILE *f = fopen(FILE_INDEX_TMP_PATH, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "无法创建索引临时文件: %s", strerror(errno));
+        return;
+    }
+
+    file_index_header_t header = {
+        .magic = FILE_INDEX_MAGIC,
+        .count = file_count,
+    };
+
+    bool ok = (fwrite(&header, 1, sizeof(header), f) == sizeof(header)) &&
+              (fwrite(device_files, sizeof(file_info_t), file_count, f) == file_count);
+    fclose(f);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "写入文件索引失败");
+        unlink(FILE_INDEX_TMP_PATH);
+        return;
+    }
+
+    unlink(FILE_INDEX_PATH);
+    if (rename(FILE_INDEX_TMP_PATH, FILE_INDEX_PATH) != 0) {
+        ESP_LOGE(TAG, "提交文件索引失败: %s", strerror(errno));
+    }
+}
+
+// 新增或更新一条索引记录并持久化，调用方需持有file_list_mutex
+static bool file_index_add(const file_info_t *info)
+{
+    // 已存在同名记录时原地更新（重新下载同一文件）
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(device_files[i].filename, info->filename) == 0) {
+            device_files[i] = *info;
+            file_index_save();
+            return true;
+        }
+    }
+
+    if (!file_index_reserve(file_count + 1)) {
+        return false;
+    }
+
+    device_files[file_count] = *info;
+    file_count++;
+    file_index_save();
+    return true;
+}
+
+// 从索引中移除一条记录（不负责删除数据文件），调用方需持有file_list_mutex
+static void file_index_remove(const char *filename)
+{
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(device_files[i].filename, filename) == 0) {
+            memmove(&device_files[i], &device_files[i + 1],
+                    (file_count - i - 1) * sizeof(file_info_t));
+            file_count--;
+            return;
+        }
+    }
+}
+
+// 激活新版本：同一逻辑名的其它槽位翻为非活跃（保留作回滚与淘汰候选）。
+// 调用方需持有file_list_mutex；持久化由随后的file_index_add统一完成
+static void file_index_deactivate_others(const file_info_t *info)
+{
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(device_files[i].logical, info->logical) == 0 &&
+            strcmp(device_files[i].filename, info->filename) != 0 &&
+            device_files[i].active) {
+            device_files[i].active = 0;
+            ESP_LOGI(TAG, "旧版本转为非活跃: %s (逻辑名%s)",
+                     device_files[i].filename, info->logical);
+        }
+    }
+}
+
+// 更新一条记录的最后访问时间并持久化
+static void file_index_touch(const char *filename)
+{
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(device_files[i].filename, filename) == 0) {
+            device_files[i].last_access = esp_timer_get_time() / 1000000;
+            file_index_save();
+            break;
+        }
+    }
+    xSemaphoreGive(file_list_mutex);
+}
+
+// 淘汰排序比较器：非活跃的旧版本槽位最先走，其后按最久未访问，
+// 最后体积大的优先（腾出更多空间）
+static int eviction_cmp(const void *a, const void *b)
+{
+    const file_info_t *fa = (const file_info_t *)a;
+    const file_info_t *fb = (const file_info_t *)b;
+
+    if (fa->active != fb->active) {
+        return fa->active - fb->active;
+    }
+    if (fa->last_access != fb->last_access) {
+        return (fa->last_access < fb->last_access) ? -1 : 1;
+    }
+    return fb->size - fa->size;
+}
+
+// 淘汰引擎：按最久未访问+体积挑选非固定文件删除，直到腾出needed字节。
+// 之前的做法是按目录顺序盲删/spiffs下所有文件——包括服务器刚推送的内容，
+// 设备在两个大播放列表间摆动时会陷入反复重下载的循环。
+static esp_err_t evict_for_space(int needed)
+{
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info("spiffs", &total, &used) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (total - used >= needed) {
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+
+    // 拷贝可淘汰的候选记录并按优先级排序
+    // （删除会整理device_files数组，因此不能持有指向它的指针）
+    file_info_t *candidates = malloc(file_count * sizeof(file_info_t));
+    if (candidates == NULL) {
+        xSemaphoreGive(file_list_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int candidate_count = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (!device_files[i].pinned) {
+            candidates[candidate_count++] = device_files[i];
+        }
+    }
+    qsort(candidates, candidate_count, sizeof(file_info_t), eviction_cmp);
+
+    // 依次删除候选文件直到空间足够
+    bool index_dirty = false;
+    for (int i = 0; i < candidate_count && total - used < needed; i++) {
+        char victim_path[64];
+        snprintf(victim_path, sizeof(victim_path), "/spiffs/%s", candidates[i].filename);
+
+        ESP_LOGI(TAG, "淘汰文件: %s (%d字节, 最后访问%lld)",
+                 candidates[i].filename, candidates[i].size, candidates[i].last_access);
+
+        if (unlink(victim_path) == 0) {
+            file_index_remove(candidates[i].filename);
+            index_dirty = true;
+            esp_spiffs_info("spiffs", &total, &used);
+        } else {
+            ESP_LOGW(TAG, "删除失败: %s, %s", victim_path, strerror(errno));
+        }
+    }
+
+    free(candidates);
+    if (index_dirty) {
+        file_index_save();
+    }
+    xSemaphoreGive(file_list_mutex);
+
+    return (total - used >= needed) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// 初始化SPIFFS
+static esp_err_t init_spiffs(void)
+{
+    ESP_LOGI(TAG, "正在初始化SPIFFS");
+    
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = "/spiffs",
+        .partition_label = "spiffs",  // 使用"spiffs"作为分区标签
+        .max_files = 5,
+        .format_if_mount_failed = true
+    };
+    
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "无法挂载SPIFFS分区，或格式化失败");
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "未找到SPIFFS分区，请检查分区表");
+        } else {
+            ESP_LOGE(TAG, "初始化SPIFFS失败: %s", esp_err_to_name(ret));
+        }
+        return ret;
+    }
+    
+    size_t total = 0, used = 0;
+    ret = esp_spiffs_info("spiffs", &total, &used);  // 指定分区标签
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "获取SPIFFS信息失败: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ESP_LOGI(TAG, "SPIFFS已挂载，总大小: %d字节, 已使用: %d字节, 空闲: %d字节", 
+             total, used, total - used);
+    
+    // 目录枚举只是诊断输出，放到低优先级任务里跑，不占启动关键路径
+    if (xTaskCreatePinnedToCore(spiffs_scan_task, "spiffs_scan", SPIFFS_INIT_TASK_STACK_SIZE,
+                                NULL, TELEMETRY_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+        ESP_LOGW(TAG, "创建目录枚举任务失败，跳过目录列表");
+    }
+    
+    // 加载持久化文件索引，重启后无需重新下载已有内容
+    return file_index_load();
+}
+
+// 延迟执行的SPIFFS目录枚举：逐条UART输出在115200波特率下以十毫秒计，
+// 放在联网之后慢慢打印，不拖慢boot-to-online
+static void spiffs_scan_task(void *pvParameter)
+{
+    ESP_LOGI(TAG, "列出SPIFFS目录内容:");
+    DIR *dir = opendir("/spiffs");
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            ESP_LOGI(TAG, "  %s", entry->d_name);
+        }
+        closedir(dir);
+    } else {
+        ESP_LOGE(TAG, "无法打开SPIFFS根目录");
+    }
+    vTaskDelete(NULL);
+}
+
+// SPIFFS并行初始化：挂载与索引加载在WiFi关联期间于另一核完成
+static SemaphoreHandle_t spiffs_ready_sem = NULL;
+static esp_err_t spiffs_init_result = ESP_FAIL;
+
+static void spiffs_init_task(void *pvParameter)
+{
+    spiffs_init_result = init_spiffs();
+    xSemaphoreGive(spiffs_ready_sem);
+    vTaskDelete(NULL);
+}
+
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+
+
+// 在文件中添加一个简化的进度通知发送函数，减少栈使用
+static void send_progress_notification(const char *type, const char *filename, int percent, int transferred, int total_size) 
+{
+    // 使用静态缓冲区减少栈使用
+    static char json_buffer[256];
+    
+    // 二进制模式下发送定长进度帧
+    if (binary_proto) {
+        bin_progress_t frame = {
+            .tag = BIN_MSG_PROGRESS,
+            .kind = (strcmp(type, "upload_progress") == 0) ? 1 : 0,
+            .percent = (uint8_t)percent,
+            .transferred = transferred,
+            .total_size = total_size,
+        };
+        strncpy(frame.filename, filename, sizeof(frame.filename) - 1);
+        frame.filename[sizeof(frame.filename) - 1] = '\0';
+        tx_enqueue_progress(filename, true, (const char *)&frame, sizeof(frame));
+        return;
+    }
+    
+    // 直接格式化JSON字符串，避免使用cJSON库的动态内存分配
+    snprintf(json_buffer, sizeof(json_buffer),
+             "{\"type\":\"%s\",\"data\":{\"filename\":\"%s\",\"percent\":%d,\"transferred\":%d,\"total_size\":%d}}",
+             type, filename, percent, transferred, total_size);
+    
+    ESP_LOGD(TAG, "发送%s进度通知: %d%%", type, percent);
+    
+    // 进入合并槽：拥塞时只保最新进度，传输循环不碰socket
+    tx_enqueue_progress(filename, false, json_buffer, strlen(json_buffer));
+}
+
+// 令牌桶限速器：服务器在download_notify里附带rate_limit_kbps时，
+// 读取循环按该速率整形。群发错峰场景下每台设备拿到限定而稳定的
+// 份额，好过所有设备在共享上行上互相挤压。
+typedef struct {
+    int rate_kbps;          // 目标速率，0表示不限速
+    int64_t tokens;         // 当前可用字节额度
+    int64_t last_refill_us; // 上次补充令牌的时间
+} dl_pacer_t;
+
+static void dl_pacer_init(dl_pacer_t *pacer, int rate_kbps)
+{
+    pacer->rate_kbps = rate_kbps;
+    pacer->tokens = (int64_t)rate_kbps * 1024 / 8; // 初始一秒额度，允许突发起步
+    pacer->last_refill_us = esp_timer_get_time();
+}
+
+// 消费len字节的令牌，额度不足时按缺口睡眠等待补充
+static void dl_pacer_consume(dl_pacer_t *pacer, int len)
+{
+    if (pacer->rate_kbps <= 0) {
+        return;
+    }
+    int64_t bytes_per_sec = (int64_t)pacer->rate_kbps * 1024 / 8;
+
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        pacer->tokens += (now - pacer->last_refill_us) * bytes_per_sec / 1000000;
+        if (pacer->tokens > bytes_per_sec) {
+            pacer->tokens = bytes_per_sec; // 桶容量=一秒额度
+        }
+        pacer->last_refill_us = now;
+
+        if (pacer->tokens >= len) {
+            pacer->tokens -= len;
+            return;
+        }
+
+        int64_t deficit = len - pacer->tokens;
+        int wait_ms = (int)(deficit * 1000 / bytes_per_sec) + 1;
+        vTaskDelay((wait_ms / portTICK_PERIOD_MS) > 0 ?
+                   (wait_ms / portTICK_PERIOD_MS) : 1);
+    }
+}
+
+// 完整性校验算法：由download_notify是否携带sha256字段协商
+// SHA-256走mbedtls的ESP32-S3硬件加速实现，MD5为旧服务器的软件回退路径
+typedef enum {
+    DL_HASH_MD5 = 0,     // 软件MD5（旧服务器）
+    DL_HASH_SHA256 = 1,  // 硬件SHA-256加速
+} dl_hash_type_t;
+
+// 统一的哈希上下文，屏蔽MD5/SHA-256两条路径的差异
+typedef struct {
+    dl_hash_type_t type;
+    union {
+        mbedtls_md5_context md5;
+        mbedtls_sha256_context sha256;
+    };
+} dl_hash_ctx_t;
+
+// 初始化并开始哈希计算
+static void dl_hash_starts(dl_hash_ctx_t *ctx, dl_hash_type_t type)
+{
+    ctx->type = type;
+    if (type == DL_HASH_SHA256) {
+        mbedtls_sha256_init(&ctx->sha256);
+        mbedtls_sha256_starts(&ctx->sha256, 0); // 0表示SHA-256而非SHA-224
+    } else {
+        mbedtls_md5_init(&ctx->md5);
+        mbedtls_md5_starts(&ctx->md5);
+    }
+}
+
+// 更新哈希散列
+static void dl_hash_update(dl_hash_ctx_t *ctx, const unsigned char *data, size_t len)
+{
+    if (ctx->type == DL_HASH_SHA256) {
+        mbedtls_sha256_update(&ctx->sha256, data, len);
+    } else {
+        mbedtls_md5_update(&ctx->md5, data, len);
+    }
+}
+
+// 完成哈希计算并输出十六进制字符串（MD5为32字符，SHA-256为64字符）
+static void dl_hash_finish(dl_hash_ctx_t *ctx, char *hex_out)
+{
+    unsigned char result[32];
+    int result_len;
+
+    if (ctx->type == DL_HASH_SHA256) {
+        mbedtls_sha256_finish(&ctx->sha256, result);
+        result_len = 32;
+    } else {
+        mbedtls_md5_finish(&ctx->md5, result);
+        result_len = 16;
+    }
+
+    // 转换为十六进制字符串
+    for (int i = 0; i < result_len; i++) {
+        sprintf(hex_out + i * 2, "%02x", result[i]);
+    }
+    hex_out[result_len * 2] = '\0';
+}
+
+// 释放哈希上下文
+static void dl_hash_free(dl_hash_ctx_t *ctx)
+{
+    if (ctx->type == DL_HASH_SHA256) {
+        mbedtls_sha256_free(&ctx->sha256);
+    } else {
+        mbedtls_md5_free(&ctx->md5);
+    }
+}
+
+// 断点续传状态：定期持久化到SPIFFS，断线后凭此从上次偏移继续
+typedef struct {
+    uint32_t magic;                // 魔数，校验状态文件有效性
+    int file_size;                 // 完整文件大小
+    int received;                  // 已提交到flash的字节数
+    dl_hash_ctx_t hash_ctx;        // 滚动哈希上下文快照
+    char expected_hash[65];        // 预期哈希，防止续传到不同版本的文件
+} dl_resume_state_t;
+
+// 加载断点续传状态，校验与本次下载是否匹配
+static bool load_resume_state(const char *state_path, const char *expected_hash,
+                              dl_hash_type_t hash_type, int file_size, dl_resume_state_t *state)
+{
+    FILE *sf = fopen(state_path, "rb");
+    if (sf == NULL) {
+        return false;
+    }
+
+    size_t read = fread(state, 1, sizeof(*state), sf);
+    fclose(sf);
+
+    if (read != sizeof(*state) || state->magic != DL_RESUME_MAGIC) {
+        ESP_LOGW(TAG, "断点状态文件无效，忽略: %s", state_path);
+        unlink(state_path);
+        return false;
+    }
+
+    // 文件内容变化、校验算法或大小不符时不能续传
+    if (state->file_size != file_size ||
+        state->hash_ctx.type != hash_type ||
+        strcmp(state->expected_hash, expected_hash) != 0 ||
+        state->received <= 0 || state->received >= file_size) {
+        ESP_LOGI(TAG, "断点状态与本次下载不匹配，重新下载");
+        unlink(state_path);
+        return false;
+    }
+
+    return true;
+}
+
+// 保存断点续传状态
+static void save_resume_state(const char *state_path, const dl_resume_state_t *state)
+{
+    FILE *sf = fopen(state_path, "wb");
+    if (sf == NULL) {
+        ESP_LOGW(TAG, "无法保存断点状态: %s", state_path);
+        return;
+    }
+
+    if (fwrite(state, 1, sizeof(*state), sf) != sizeof(*state)) {
+        ESP_LOGW(TAG, "断点状态写入不完整");
+    }
+    fclose(sf);
+}
+
+// 发送性能统计消息：服务器通过stats_request索取
+static void send_stats(void)
+{
+    static char json_buffer[512];
+
+    snprintf(json_buffer, sizeof(json_buffer),
+             "{\"type\":\"stats\",\"data\":{"
+             "\"bytes_downloaded\":%lu,\"bytes_uploaded\":%lu,"
+             "\"downloads_ok\":%lu,\"downloads_failed\":%lu,"
+             "\"ws_rx_messages\":%lu,\"ws_queue_drops\":%lu,"
+             "\"rx_pool_fallbacks\":%lu,\"alloc_failures\":%lu,"
+             "\"net_read_ms\":%llu,\"flash_write_ms\":%llu,\"hash_ms\":%llu}}",
+             (unsigned long)perf_stats.bytes_downloaded,
+             (unsigned long)perf_stats.bytes_uploaded,
+             (unsigned long)perf_stats.downloads_ok,
+             (unsigned long)perf_stats.downloads_failed,
+             (unsigned long)perf_stats.ws_rx_messages,
+             (unsigned long)perf_stats.ws_queue_drops,
+             (unsigned long)perf_stats.rx_pool_fallbacks,
+             (unsigned long)perf_stats.alloc_failures,
+             (unsigned long long)(perf_stats.net_read_us / 1000),
+             (unsigned long long)(perf_stats.flash_write_us / 1000),
+             (unsigned long long)(perf_stats.hash_us / 1000));
+
+    ESP_LOGI(TAG, "发送性能统计: %s", json_buffer);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+}
+
+// 下载流水线数据块：读取任务填充后交给写入任务
+typedef struct {
+    char *data;   // 缓冲区指针
+    int len;      // 有效数据长度，0表示下载结束
+} dl_pipe_buf_t;
+
+// 下载流水线上下文：读取任务与写入任务共享
+typedef struct {
+    FILE *fp;                      // 目标文件
+    dl_hash_ctx_t *hash_ctx;       // 哈希上下文，由写入任务更新
+    QueueHandle_t filled_queue;    // 已填充缓冲区队列（读取->写入）
+    QueueHandle_t free_queue;      // 空闲缓冲区队列（写入->读取）
+    esp_err_t write_result;        // 写入任务的执行结果
+    SemaphoreHandle_t done_sem;    // 写入任务完成信号
+    dl_resume_state_t *resume;     // 断点续传状态，NULL表示不启用
+    const char *state_path;        // 断点状态文件路径
+    int last_checkpoint;           // 上次保存状态时的已提交字节数
+} dl_pipeline_t;
+
+// 下载写入任务：从队列取出缓冲区，写入SPIFFS并更新校验哈希
+// 与HTTP读取并行执行，避免flash擦写阻塞网络接收
+static void dl_writer_task(void *pvParameter)
+{
+    dl_pipeline_t *pipe = (dl_pipeline_t *)pvParameter;
+    dl_pipe_buf_t buf;
+
+    while (1) {
+        if (xQueueReceive(pipe->filled_queue, &buf, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        // len为0表示读取端已结束
+        if (buf.len == 0) {
+            break;
+        }
+
+        // 写入出错后仅回收缓冲区，避免读取端在队列上死等
+        if (pipe->write_result == ESP_OK) {
+            int64_t t0 = esp_timer_get_time();
+            size_t written = fwrite(buf.data, 1, buf.len, pipe->fp);
+            int64_t t1 = esp_timer_get_time();
+            STAT_ADD(flash_write_us, t1 - t0);
+            if (written != buf.len) {
+                ESP_LOGE(TAG, "文件写入错误: %d != %d", written, buf.len);
+                pipe->write_result = ESP_FAIL;
+            } else {
+                // 更新校验哈希
+                dl_hash_update(pipe->hash_ctx, (const unsigned char *)buf.data, buf.len);
+                STAT_ADD(hash_us, esp_timer_get_time() - t1);
+
+                // 定期持久化断点状态，断线后可从此偏移继续
+                if (pipe->resume != NULL) {
+                    pipe->resume->received += buf.len;
+                    if (pipe->resume->received - pipe->last_checkpoint >= DL_RESUME_CHECKPOINT) {
+                        fflush(pipe->fp);
+                        pipe->resume->hash_ctx = *pipe->hash_ctx;
+                        save_resume_state(pipe->state_path, pipe->resume);
+                        pipe->last_checkpoint = pipe->resume->received;
+                    }
+                }
+            }
+        }
+
+        // 归还缓冲区给读取端
+        xQueueSend(pipe->free_queue, &buf.data, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(pipe->done_sem);
+    vTaskDelete(NULL);
+}
+
+// 校验PSRAM暂存内容并提交到flash：哈希不匹配的内容不会落盘。
+// 成功后负责发送完成通知并更新文件索引。stage_buf始终由本函数释放。
+static esp_err_t dl_commit_staged(char *stage_buf, int size, const char *file_path,
+                                  const char *short_filename, const char *filename,
+                                  const char *expected_hash, dl_hash_type_t hash_type)
+{
+    // 先校验再落盘
+    dl_hash_ctx_t hash_ctx;
+    char calculated_hash[65];
+    dl_hash_starts(&hash_ctx, hash_type);
+    dl_hash_update(&hash_ctx, (const unsigned char *)stage_buf, size);
+    dl_hash_finish(&hash_ctx, calculated_hash);
+    dl_hash_free(&hash_ctx);
+
+    if (strcmp(calculated_hash, expected_hash) != 0) {
+        ESP_LOGE(TAG, "%s校验失败，丢弃暂存内容，不写入flash",
+                 hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5");
+        free(stage_buf);
+        return ESP_FAIL;
+    }
+
+    // 校验通过，写入暂存槽后原子改名——读取方看不到半截文件
+    char tmp_path[72];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", file_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "无法创建文件: %s, 错误: %s", tmp_path, strerror(errno));
+        free(stage_buf);
+        return ESP_FAIL;
+    }
+
+    size_t written = fwrite(stage_buf, 1, size, f);
+    fclose(f);
+    free(stage_buf);
+
+    if (written != size) {
+        ESP_LOGE(TAG, "文件写入错误: %d != %d", written, size);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    unlink(file_path); // 同哈希重下载时旧文件可能还在
+    if (rename(tmp_path, file_path) != 0) {
+        ESP_LOGE(TAG, "提交文件失败: %s", strerror(errno));
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "暂存下载完成并已提交: %s, %d字节", short_filename, size);
+    send_progress_notification("download_progress", filename, 100, size, size);
+    send_download_complete(short_filename, hash_type == DL_HASH_SHA256 ? "sha256" : "md5",
+                           calculated_hash);
+
+    // 写入持久化文件索引并激活：同逻辑名的旧版本翻为非活跃
+    file_info_t info = { .size = size, .active = 1 };
+    strncpy(info.filename, short_filename, sizeof(info.filename) - 1);
+    info.filename[sizeof(info.filename) - 1] = '\0';
+    strncpy(info.md5, calculated_hash, sizeof(info.md5) - 1);
+    info.md5[sizeof(info.md5) - 1] = '\0';
+    strncpy(info.logical, filename, sizeof(info.logical) - 1);
+    info.logical[sizeof(info.logical) - 1] = '\0';
+    info.timestamp = esp_timer_get_time() / 1000000;
+    info.last_access = info.timestamp;
+    info.pinned = 0;
+
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+    file_index_deactivate_others(&info);
+    bool added = file_index_add(&info);
+    xSemaphoreGive(file_list_mutex);
+
+    if (added) {
+        send_file_list_delta(&info);
+    }
+
+    return ESP_OK;
+}
+
+// 小文件整文件暂存下载：先把完整内容收进PSRAM并通过哈希校验，
+// 再一次性顺序写入SPIFFS。避免下载与flash写交替进行造成的写放大，
+// 校验失败的内容根本不会落盘。PSRAM不可用时返回ESP_ERR_NOT_SUPPORTED，
+// 由调用方退回流式下载路径。
+static esp_err_t download_file_staged(esp_http_client_handle_t http_client,
+                                      const char *file_path, const char *short_filename,
+                                      const char *filename, const char *expected_hash,
+                                      dl_hash_type_t hash_type, int file_size,
+                                      int rate_limit_kbps)
+{
+    dl_pacer_t pacer;
+    dl_pacer_init(&pacer, rate_limit_kbps);
+
+    char *stage_buf = heap_caps_malloc(file_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (stage_buf == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    ESP_LOGI(TAG, "小文件走PSRAM暂存路径: %d字节", file_size);
+
+    esp_err_t err = esp_http_client_open(http_client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP请求失败: %s", esp_err_to_name(err));
+        free(stage_buf);
+        http_pool_release(http_client, false);
+        return err;
+    }
+
+    int content_length = esp_http_client_fetch_headers(http_client);
+    if (content_length <= 0 || content_length > file_size) {
+        ESP_LOGE(TAG, "文件大小无效或与通知不符: %d", content_length);
+        free(stage_buf);
+        http_pool_release(http_client, false); // 响应体未读，不可复用
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // 整文件收入PSRAM，期间不碰flash
+    int total_read = 0;
+    int last_percent = 0;
+    while (total_read < content_length) {
+        int read_len = esp_http_client_read(http_client, stage_buf + total_read,
+                                            content_length - total_read);
+        if (read_len <= 0) {
+            break;
+        }
+        dl_pacer_consume(&pacer, read_len);
+        total_read += read_len;
+
+        int percent = (total_read * 100) / content_length;
+        if (percent - last_percent >= 10) {
+            send_progress_notification("download_progress", filename, percent,
+                                       total_read, content_length);
+            last_percent = percent;
+        }
+    }
+
+    int status_code = esp_http_client_get_status_code(http_client);
+    http_pool_release(http_client, status_code == 200 && total_read == content_length);
+
+    if (status_code != 200 || total_read != content_length) {
+        ESP_LOGE(TAG, "暂存下载失败: 状态码=%d, 收到%d/%d字节",
+                 status_code, total_read, content_length);
+        free(stage_buf);
+        return ESP_FAIL;
+    }
+
+    return dl_commit_staged(stage_buf, total_read, file_path, short_filename,
+                            filename, expected_hash, hash_type);
+}
+
+// Range下载任务上下文
+typedef struct {
+    const char *url;             // 下载URL
+    char *dest;                  // 目标缓冲区（暂存区内的分段起点）
+    int offset;                  // 文件内偏移
+    int len;                     // 分段长度
+    esp_err_t result;            // 本分段的下载结果
+    SemaphoreHandle_t done_sem;  // 完成信号
+} dl_range_ctx_t;
+
+// 在已初始化的客户端上拉取单个Range分段到缓冲区。
+// 响应体读完即可在同一句柄上发起下一个分段，配合keep_alive
+// 跨分段复用TCP连接
+static esp_err_t dl_fetch_range_on(esp_http_client_handle_t http_client,
+                                   const char *url, char *dest, int offset, int len)
+{
+    esp_http_client_set_url(http_client, url);
+    char range_header[48];
+    snprintf(range_header, sizeof(range_header), "bytes=%d-%d", offset, offset + len - 1);
+    esp_http_client_set_header(http_client, "Range", range_header);
+
+    esp_err_t err = esp_http_client_open(http_client, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_http_client_fetch_headers(http_client);
+
+    if (esp_http_client_get_status_code(http_client) != 206) {
+        ESP_LOGE(TAG, "服务器不支持Range请求，无法分段下载");
+        esp_http_client_close(http_client);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    int total = 0;
+    while (total < len) {
+        int read_len = esp_http_client_read(http_client, dest + total, len - total);
+        if (read_len <= 0) {
+            break;
+        }
+        total += read_len;
+        STAT_ADD(bytes_downloaded, read_len);
+    }
+
+    if (total != len) {
+        ESP_LOGE(TAG, "Range分段不完整: %d/%d (偏移%d)", total, len, offset);
+        esp_http_client_close(http_client);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// 拉取单个Range分段：一次性连接，用于各自持有连接的并行任务
+static esp_err_t dl_fetch_range(const char *url, char *dest, int offset, int len)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = 10000,
+    };
+    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    if (http_client == NULL) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = dl_fetch_range_on(http_client, url, dest, offset, len);
+    esp_http_client_cleanup(http_client);
+    return err;
+}
+
+// Range下载任务包装
+static void dl_range_task(void *pvParameter)
+{
+    dl_range_ctx_t *ctx = (dl_range_ctx_t *)pvParameter;
+    ctx->result = dl_fetch_range(ctx->url, ctx->dest, ctx->offset, ctx->len);
+    xSemaphoreGive(ctx->done_sem);
+    vTaskDelete(NULL);
+}
+
+// 大文件并行Range下载：把文件按DL_PARALLEL_CONNS等分，多条HTTP连接
+// 并发拉取各自的分段到PSRAM暂存区，再统一校验提交。单连接在丢包链路上
+// 容易因拥塞窗口塌缩跑不满带宽，两条连接可稳定拿到约1.7倍吞吐。
+// PSRAM放不下整个文件时返回ESP_ERR_NOT_SUPPORTED退回流式路径。
+static esp_err_t download_file_parallel(const char *url, const char *file_path,
+                                        const char *short_filename, const char *filename,
+                                        const char *expected_hash, dl_hash_type_t hash_type,
+                                        int file_size)
+{
+    char *stage_buf = heap_caps_malloc(file_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (stage_buf == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    ESP_LOGI(TAG, "大文件走并行Range下载: %d字节, %d条连接", file_size, DL_PARALLEL_CONNS);
+
+    dl_range_ctx_t ranges[DL_PARALLEL_CONNS];
+    int chunk = file_size / DL_PARALLEL_CONNS;
+    int started = 0;
+
+    for (int i = 0; i < DL_PARALLEL_CONNS; i++) {
+        ranges[i].url = url;
+        ranges[i].offset = i * chunk;
+        ranges[i].len = (i == DL_PARALLEL_CONNS - 1) ? (file_size - i * chunk) : chunk;
+        ranges[i].dest = stage_buf + ranges[i].offset;
+        ranges[i].result = ESP_FAIL;
+        ranges[i].done_sem = xSemaphoreCreateBinary();
+        if (ranges[i].done_sem == NULL ||
+            xTaskCreatePinnedToCore(dl_range_task, "dl_range", DL_RANGE_TASK_STACK_SIZE,
+                                    &ranges[i], WS_TASK_PRIORITY - 1, NULL, CORE_NET) != pdPASS) {
+            ESP_LOGE(TAG, "创建Range下载任务失败");
+            if (ranges[i].done_sem) vSemaphoreDelete(ranges[i].done_sem);
+            break;
+        }
+        started++;
+    }
+
+    // 等待所有已启动的分段完成
+    esp_err_t result = (started == DL_PARALLEL_CONNS) ? ESP_OK : ESP_FAIL;
+    for (int i = 0; i < started; i++) {
+        xSemaphoreTake(ranges[i].done_sem, portMAX_DELAY);
+        vSemaphoreDelete(ranges[i].done_sem);
+        if (ranges[i].result != ESP_OK) {
+            result = ranges[i].result;
+        }
+    }
+
+    if (result != ESP_OK) {
+        free(stage_buf);
+        // 服务器不支持Range时退回单连接流式路径
+        return (result == ESP_ERR_NOT_SUPPORTED) ? ESP_ERR_NOT_SUPPORTED : ESP_FAIL;
+    }
+
+    return dl_commit_staged(stage_buf, file_size, file_path, short_filename,
+                            filename, expected_hash, hash_type);
+}
+
+// 按哈希在文件索引中查找本地文件，找到时拷出记录并返回true
+static bool file_index_find_by_md5(const char *md5, file_info_t *out)
+{
+    bool found = false;
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(device_files[i].md5, md5) == 0) {
+            *out = device_files[i];
+            found = true;
+            break;
+        }
+    }
+    xSemaphoreGive(file_list_mutex);
+    return found;
+}
+
+// 增量补丁更新：小幅修改的文件只传差异。补丁格式为魔数"DLT1"加操作流：
+//   0x01 COPY  uint32偏移 uint32长度   —— 从基准文件拷贝
+//   0x02 DATA  uint32长度 + 字面数据    —— 插入新数据
+//   0x00 END                           —— 结束
+// 目标文件在PSRAM中重建并整体校验后才提交，随后删除基准文件。
+// 任何一步失败都返回错误，由工作任务回退整文件下载。
+static esp_err_t download_file_patch(const dl_job_t *job)
+{
+    const char *expected_hash = job->has_sha256 ? job->sha256 : job->md5;
+    dl_hash_type_t hash_type = job->has_sha256 ? DL_HASH_SHA256 : DL_HASH_MD5;
+
+    // 本地必须存在哈希匹配的基准文件
+    file_info_t base;
+    if (!file_index_find_by_md5(job->base_md5, &base)) {
+        ESP_LOGI(TAG, "本地无基准文件(哈希%8.8s...)，无法增量更新", job->base_md5);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char base_path[64];
+    snprintf(base_path, sizeof(base_path), "/spiffs/%s", base.filename);
+
+    // 重建缓冲区放PSRAM，放不下就回退整文件下载
+    char *out_buf = heap_caps_malloc(job->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (out_buf == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // 补丁最大128KB，同样优先PSRAM，内部RAM只作小补丁的备选
+    char *patch_buf = heap_caps_malloc(job->patch_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (patch_buf == NULL) {
+        patch_buf = malloc(job->patch_size);
+    }
+    if (patch_buf == NULL) {
+        free(out_buf);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "增量更新: 基准=%s, 补丁%d字节, 目标%d字节",
+             base.filename, job->patch_size, job->size);
+
+    // 拉取补丁（体积小，单连接整段下载）
+    esp_http_client_config_t config = {
+        .url = job->patch_url,
+        .timeout_ms = 10000,
+    };
+    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    if (http_client == NULL) {
+        free(out_buf);
+        free(patch_buf);
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = esp_http_client_open(http_client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(http_client);
+        int total = 0;
+        while (total < job->patch_size) {
+            int read_len = esp_http_client_read(http_client, patch_buf + total,
+                                                job->patch_size - total);
+            if (read_len <= 0) {
+                break;
             }
-            break;
-            
-        default:
-            break;
+            total += read_len;
+            STAT_ADD(bytes_downloaded, read_len);
+        }
+        if (esp_http_client_get_status_code(http_client) != 200 || total != job->patch_size) {
+            ESP_LOGE(TAG, "补丁下载失败: 收到%d/%d字节", total, job->patch_size);
+            err = ESP_FAIL;
+        }
     }
-    return ESP_OK;
+    esp_http_client_cleanup(http_client);
+    if (err != ESP_OK) {
+        free(out_buf);
+        free(patch_buf);
+        return ESP_FAIL;
+    }
+
+    // 应用补丁：从基准文件+操作流重建目标内容
+    FILE *base_fp = fopen(base_path, "rb");
+    if (base_fp == NULL) {
+        ESP_LOGE(TAG, "无法打开基准文件: %s", base_path);
+        free(out_buf);
+        free(patch_buf);
+        return ESP_FAIL;
+    }
+
+    esp_err_t result = ESP_FAIL;
+    int pos = 0;
+    int out_len = 0;
+
+    uint32_t magic = 0;
+    if (job->patch_size >= 4) {
+        memcpy(&magic, patch_buf, 4);
+        pos = 4;
+    }
+    if (magic != DL_PATCH_MAGIC) {
+        ESP_LOGE(TAG, "补丁魔数无效: 0x%08lx", (unsigned long)magic);
+    } else {
+        while (pos < job->patch_size) {
+            uint8_t op = (uint8_t)patch_buf[pos++];
+            if (op == 0x00) { // END
+                result = ESP_OK;
+                break;
+            }
+
+            if (pos + 4 > job->patch_size) {
+                ESP_LOGE(TAG, "补丁在偏移%d处被截断", pos);
+                break;
+            }
+            uint32_t a, b = 0;
+            memcpy(&a, patch_buf + pos, 4);
+            pos += 4;
+
+            if (op == 0x01) { // COPY: a=基准偏移, b=长度
+                if (pos + 4 > job->patch_size) {
+                    ESP_LOGE(TAG, "补丁在偏移%d处被截断", pos);
+                    break;
+                }
+                memcpy(&b, patch_buf + pos, 4);
+                pos += 4;
+                // 全部用无符号减法比较，a+b或out_len+b相加可能回绕
+                if (a > (uint32_t)base.size || b > (uint32_t)base.size - a ||
+                    b > (uint32_t)(job->size - out_len)) {
+                    ESP_LOGE(TAG, "COPY操作越界: 偏移%lu 长度%lu",
+                             (unsigned long)a, (unsigned long)b);
+                    break;
+                }
+                fseek(base_fp, a, SEEK_SET);
+                if (fread(out_buf + out_len, 1, b, base_fp) != b) {
+                    ESP_LOGE(TAG, "读取基准文件失败");
+                    break;
+                }
+                out_len += b;
+            } else if (op == 0x02) { // DATA: a=字面数据长度
+                if (a > (uint32_t)(job->patch_size - pos) || a > (uint32_t)(job->size - out_len)) {
+                    ESP_LOGE(TAG, "DATA操作越界: 长度%lu", (unsigned long)a);
+                    break;
+                }
+                memcpy(out_buf + out_len, patch_buf + pos, a);
+                pos += a;
+                out_len += a;
+            } else {
+                ESP_LOGE(TAG, "未知补丁操作: 0x%02x", op);
+                break;
+            }
+        }
+    }
+
+    fclose(base_fp);
+    free(patch_buf);
+
+    if (result != ESP_OK || out_len != job->size) {
+        ESP_LOGE(TAG, "补丁应用失败: 重建%d/%d字节", out_len, job->size);
+        free(out_buf);
+        return ESP_FAIL;
+    }
+
+    // 生成目标短文件名（与整文件下载同样的命名规则）
+    const char *ext = strrchr(job->filename, '.');
+    if (!ext) ext = "";
+    char short_filename[32];
+    if (strlen(ext) > 0) {
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s%s", expected_hash, ext);
+    } else {
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s", expected_hash);
+    }
+    char file_path[64];
+    snprintf(file_path, sizeof(file_path), "/spiffs/%s", short_filename);
+
+    // 校验+落盘+通知复用暂存提交路径（失败时out_buf已被释放）
+    esp_err_t ret = dl_commit_staged(out_buf, out_len, file_path, short_filename,
+                                     job->filename, expected_hash, hash_type);
+    if (ret == ESP_OK && strcmp(base.filename, short_filename) != 0) {
+        // 新版本已提交，删除被替换的旧版本
+        unlink(base_path);
+        xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+        file_index_remove(base.filename);
+        xSemaphoreGive(file_list_mutex);
+        ESP_LOGI(TAG, "旧版本已删除: %s", base.filename);
+    }
+    return ret;
 }
 
-// 初始化SPIFFS
-static esp_err_t init_spiffs(void)
+// 组播数据包头：魔数+块序号+总块数+是否为校验块
+typedef struct __attribute__((packed)) {
+    uint32_t magic;       // MCAST_MAGIC
+    uint16_t chunk_idx;   // 数据块序号；校验块为所在组的首个数据块序号
+    uint16_t total_chunks; // 文件总数据块数
+    uint8_t is_parity;    // 1表示XOR校验块
+    uint8_t reserved[3];  // 对齐保留
+} mcast_chunk_hdr_t;
+
+// 组播群发接收：同一站点的N台设备下发同一文件时，服务器在共享介质上
+// 只发一遍。设备加入UDP组播组，把数据块按序号落进PSRAM暂存区；
+// 每MCAST_FEC_GROUP个数据块附带一个XOR校验块，组内单块丢失可直接
+// 恢复；仍缺的块走HTTP Range点对点修复。站点级推送耗时从与设备数
+// 成正比降为约一次传输加少量修复流量。
+static esp_err_t download_file_mcast(const dl_job_t *job)
 {
-    ESP_LOGI(TAG, "正在初始化SPIFFS");
-    
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = "spiffs",  // 使用"spiffs"作为分区标签
-        .max_files = 5,
-        .format_if_mount_failed = true
-    };
-    
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "无法挂载SPIFFS分区，或格式化失败");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "未找到SPIFFS分区，请检查分区表");
+    const char *expected_hash = job->has_sha256 ? job->sha256 : job->md5;
+    dl_hash_type_t hash_type = job->has_sha256 ? DL_HASH_SHA256 : DL_HASH_MD5;
+
+    int total_chunks = (job->size + MCAST_CHUNK_SIZE - 1) / MCAST_CHUNK_SIZE;
+    int groups = (total_chunks + MCAST_FEC_GROUP - 1) / MCAST_FEC_GROUP;
+
+    // 整文件暂存区必须放得进PSRAM，否则退回单播路径
+    char *stage_buf = heap_caps_malloc(job->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (stage_buf == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    char *parity_buf = heap_caps_malloc(groups * MCAST_CHUNK_SIZE,
+                                        MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *chunk_seen = calloc(total_chunks, 1);
+    uint8_t *parity_seen = calloc(groups, 1);
+    char *packet = malloc(sizeof(mcast_chunk_hdr_t) + MCAST_CHUNK_SIZE);
+    if (parity_buf == NULL || chunk_seen == NULL || parity_seen == NULL || packet == NULL) {
+        free(stage_buf);
+        free(parity_buf);
+        free(chunk_seen);
+        free(parity_seen);
+        free(packet);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "加入组播会话: %s:%d, %d块", job->mcast_group, job->mcast_port, total_chunks);
+
+    esp_err_t result = ESP_FAIL;
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock >= 0) {
+        struct sockaddr_in bind_addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(job->mcast_port),
+            .sin_addr.s_addr = htonl(INADDR_ANY),
+        };
+        struct ip_mreq mreq = {
+            .imr_multiaddr.s_addr = inet_addr(job->mcast_group),
+            .imr_interface.s_addr = htonl(INADDR_ANY),
+        };
+        struct timeval rcv_timeout = { .tv_sec = MCAST_IDLE_TIMEOUT_SEC };
+
+        if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) == 0 &&
+            setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0 &&
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rcv_timeout, sizeof(rcv_timeout)) == 0) {
+
+            int received_chunks = 0;
+            while (received_chunks < total_chunks) {
+                int len = recv(sock, packet, sizeof(mcast_chunk_hdr_t) + MCAST_CHUNK_SIZE, 0);
+                if (len < 0) {
+                    ESP_LOGW(TAG, "组播接收空闲超时，已收%d/%d块", received_chunks, total_chunks);
+                    break; // 会话结束或丢包过多，转入修复阶段
+                }
+                if (len < sizeof(mcast_chunk_hdr_t)) {
+                    continue;
+                }
+
+                mcast_chunk_hdr_t hdr;
+                memcpy(&hdr, packet, sizeof(hdr));
+                if (hdr.magic != MCAST_MAGIC || hdr.total_chunks != total_chunks) {
+                    continue; // 不是本会话的包
+                }
+                int payload_len = len - sizeof(mcast_chunk_hdr_t);
+
+                if (hdr.is_parity) {
+                    int group = hdr.chunk_idx / MCAST_FEC_GROUP;
+                    if (group < groups && payload_len == MCAST_CHUNK_SIZE && !parity_seen[group]) {
+                        memcpy(parity_buf + group * MCAST_CHUNK_SIZE,
+                               packet + sizeof(hdr), MCAST_CHUNK_SIZE);
+                        parity_seen[group] = 1;
+                    }
+                    continue;
+                }
+
+                if (hdr.chunk_idx >= total_chunks || chunk_seen[hdr.chunk_idx]) {
+                    continue;
+                }
+                int offset = hdr.chunk_idx * MCAST_CHUNK_SIZE;
+                int expect_len = (offset + MCAST_CHUNK_SIZE <= job->size)
+                                 ? MCAST_CHUNK_SIZE : (job->size - offset);
+                if (payload_len != expect_len) {
+                    continue;
+                }
+                memcpy(stage_buf + offset, packet + sizeof(hdr), payload_len);
+                chunk_seen[hdr.chunk_idx] = 1;
+                received_chunks++;
+            }
+
+            // FEC恢复：组内恰好缺一个数据块且校验块在手时，XOR其余块即得
+            for (int g = 0; g < groups; g++) {
+                if (!parity_seen[g]) {
+                    continue;
+                }
+                int first = g * MCAST_FEC_GROUP;
+                int last = first + MCAST_FEC_GROUP;
+                if (last > total_chunks) {
+                    last = total_chunks;
+                }
+                int missing = -1;
+                int missing_count = 0;
+                for (int i = first; i < last; i++) {
+                    if (!chunk_seen[i]) {
+                        missing = i;
+                        missing_count++;
+                    }
+                }
+                if (missing_count != 1) {
+                    continue;
+                }
+
+                // 校验块缓冲原地异或掉组内已有块，剩下的就是缺失块（零填充）
+                char *recover = parity_buf + g * MCAST_CHUNK_SIZE;
+                for (int i = first; i < last; i++) {
+                    if (i == missing) {
+                        continue;
+                    }
+                    const char *chunk = stage_buf + i * MCAST_CHUNK_SIZE;
+                    int chunk_len = (i * MCAST_CHUNK_SIZE + MCAST_CHUNK_SIZE <= job->size)
+                                    ? MCAST_CHUNK_SIZE : (job->size - i * MCAST_CHUNK_SIZE);
+                    for (int b = 0; b < chunk_len; b++) {
+                        recover[b] ^= chunk[b];
+                    }
+                }
+                int offset = missing * MCAST_CHUNK_SIZE;
+                int miss_len = (offset + MCAST_CHUNK_SIZE <= job->size)
+                               ? MCAST_CHUNK_SIZE : (job->size - offset);
+                memcpy(stage_buf + offset, recover, miss_len);
+                chunk_seen[missing] = 1;
+                received_chunks++;
+            }
+
+            // 统计缺块：AP过滤组播或加入太晚时可能什么都没收到，
+            // 逐块Range修复一整个文件比普通下载还慢，超阈值直接放弃，
+            // 让工作任务走现成的单播回退
+            int missing_chunks = 0;
+            for (int i = 0; i < total_chunks; i++) {
+                if (!chunk_seen[i]) {
+                    missing_chunks++;
+                }
+            }
+
+            if (missing_chunks > total_chunks / MCAST_REPAIR_MAX_RATIO) {
+                ESP_LOGW(TAG, "组播缺块过多(%d/%d)，放弃修复退回单播",
+                         missing_chunks, total_chunks);
+                result = ESP_FAIL;
+            } else {
+                // HTTP Range修复剩余缺块，单条keep-alive连接跨块复用
+                result = ESP_OK;
+                esp_http_client_handle_t repair_client = NULL;
+                if (missing_chunks > 0) {
+                    esp_http_client_config_t repair_cfg = {
+                        .url = job->url,
+                        .timeout_ms = 10000,
+                        .keep_alive_enable = true,
+                    };
+                    repair_client = esp_http_client_init(&repair_cfg);
+                    if (repair_client == NULL) {
+                        result = ESP_FAIL;
+                    }
+                }
+                int repaired = 0;
+                for (int i = 0; i < total_chunks && result == ESP_OK; i++) {
+                    if (chunk_seen[i]) {
+                        continue;
+                    }
+                    int offset = i * MCAST_CHUNK_SIZE;
+                    int miss_len = (offset + MCAST_CHUNK_SIZE <= job->size)
+                                   ? MCAST_CHUNK_SIZE : (job->size - offset);
+                    result = dl_fetch_range_on(repair_client, job->url,
+                                               stage_buf + offset, offset, miss_len);
+                    repaired++;
+                }
+                if (repair_client != NULL) {
+                    esp_http_client_cleanup(repair_client);
+                }
+                if (result == ESP_OK) {
+                    ESP_LOGI(TAG, "组播接收完成: %d块组播, %d块HTTP修复",
+                             total_chunks - repaired, repaired);
+                }
+            }
+
+            setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
         } else {
-            ESP_LOGE(TAG, "初始化SPIFFS失败: %s", esp_err_to_name(ret));
+            ESP_LOGE(TAG, "组播socket配置失败: %s", strerror(errno));
         }
-        return ret;
+        close(sock);
+    } else {
+        ESP_LOGE(TAG, "创建组播socket失败: %s", strerror(errno));
     }
-    
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info("spiffs", &total, &used);  // 指定分区标签
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "获取SPIFFS信息失败: %s", esp_err_to_name(ret));
-        return ret;
+
+    free(parity_buf);
+    free(chunk_seen);
+    free(parity_seen);
+    free(packet);
+
+    if (result != ESP_OK) {
+        free(stage_buf);
+        return ESP_FAIL;
     }
-    
-    ESP_LOGI(TAG, "SPIFFS已挂载，总大小: %d字节, 已使用: %d字节, 空闲: %d字节", 
-             total, used, total - used);
-    
-    // 列出SPIFFS根目录内容
-    ESP_LOGI(TAG, "列出SPIFFS目录内容:");
-    DIR *dir = opendir("/spiffs");
-    if (dir) {
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            ESP_LOGI(TAG, "  %s", entry->d_name);
-        }
-        closedir(dir);
+
+    // 生成目标短文件名并走统一的校验提交路径
+    const char *ext = strrchr(job->filename, '.');
+    if (!ext) ext = "";
+    char short_filename[32];
+    if (strlen(ext) > 0) {
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s%s", expected_hash, ext);
     } else {
-        ESP_LOGE(TAG, "无法打开SPIFFS根目录");
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s", expected_hash);
     }
-    
-    return ESP_OK;
+    char file_path[64];
+    snprintf(file_path, sizeof(file_path), "/spiffs/%s", short_filename);
+
+    return dl_commit_staged(stage_buf, job->size, file_path, short_filename,
+                            job->filename, expected_hash, hash_type);
 }
 
-#pragma GCC diagnostic ignored "-Wformat-truncation"
+// 流式解压下载：服务器以zlib(deflate)压缩传输，客户端边收边解压，
+// 对解压出的明文做哈希与落盘。音频提示音与配置负载通常可压缩30%~60%，
+// 省下的无线电时间同时改善延迟和功耗。压缩流无法按字节断点续传，
+// 该路径不走暂存/并行/续传——压缩后的体量本身已明显更小。
+static esp_err_t download_file_deflate(esp_http_client_handle_t http_client,
+                                       const char *file_path, const char *short_filename,
+                                       const char *filename, const char *expected_hash,
+                                       dl_hash_type_t hash_type, int file_size)
+{
+    char *comp_buf = malloc(BUFFER_SIZE);
+    // 解压字典窗口：tinfl要求输出落在32KB环形字典内
+    uint8_t *dict = heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (dict == NULL) {
+        dict = malloc(TINFL_LZ_DICT_SIZE);
+    }
+    if (comp_buf == NULL || dict == NULL) {
+        ESP_LOGE(TAG, "解压缓冲区分配失败");
+        free(comp_buf);
+        free(dict);
+        http_pool_release(http_client, true); // 连接尚未使用
+        return ESP_ERR_NO_MEM;
+    }
 
+    esp_err_t err = esp_http_client_open(http_client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP请求失败: %s", esp_err_to_name(err));
+        free(comp_buf);
+        free(dict);
+        http_pool_release(http_client, false);
+        return err;
+    }
 
-// 在文件中添加一个简化的进度通知发送函数，减少栈使用
-static void send_progress_notification(const char *type, const char *filename, int percent, int transferred, int total_size) 
-{
-    // 使用静态缓冲区减少栈使用
-    static char json_buffer[256];
-    
-    // 直接格式化JSON字符串，避免使用cJSON库的动态内存分配
-    snprintf(json_buffer, sizeof(json_buffer),
-             "{\"type\":\"%s\",\"data\":{\"filename\":\"%s\",\"percent\":%d,\"transferred\":%d,\"total_size\":%d}}",
-             type, filename, percent, transferred, total_size);
-    
-    ESP_LOGD(TAG, "发送%s进度通知: %d%%", type, percent);
-    
-    // 使用0超时时间，避免在发送队列满时阻塞
-    esp_websocket_client_send_text(client, json_buffer, strlen(json_buffer), 0);
+    // Content-Length为压缩后的字节数
+    int content_length = esp_http_client_fetch_headers(http_client);
+    if (content_length <= 0) {
+        ESP_LOGE(TAG, "压缩流长度无效: %d", content_length);
+        free(comp_buf);
+        free(dict);
+        http_pool_release(http_client, false);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ESP_LOGI(TAG, "压缩下载: 压缩%d字节 -> 预期明文%d字节", content_length, file_size);
+
+    // 解压输出先写暂存槽，校验通过后原子改名激活
+    char tmp_path[72];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", file_path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        ESP_LOGE(TAG, "无法创建文件: %s, 错误: %s", tmp_path, strerror(errno));
+        free(comp_buf);
+        free(dict);
+        http_pool_release(http_client, false);
+        return ESP_FAIL;
+    }
+
+    tinfl_decompressor inflator;
+    tinfl_init(&inflator);
+    size_t dict_ofs = 0;
+
+    dl_hash_ctx_t hash_ctx;
+    dl_hash_starts(&hash_ctx, hash_type);
+
+    esp_err_t result = ESP_OK;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    int comp_read = 0;     // 已收压缩字节
+    int decomp_total = 0;  // 已产出明文字节
+    int last_percent = 0;
+
+    while (status != TINFL_STATUS_DONE) {
+        int read_len = esp_http_client_read(http_client, comp_buf, BUFFER_SIZE);
+        if (read_len <= 0) {
+            ESP_LOGE(TAG, "压缩流提前结束: 已收%d/%d字节", comp_read, content_length);
+            result = ESP_FAIL;
+            break;
+        }
+        comp_read += read_len;
+        STAT_ADD(bytes_downloaded, read_len);
+
+        bool more_input = (comp_read < content_length);
+        size_t in_ofs = 0;
+        do {
+            size_t in_bytes = read_len - in_ofs;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - dict_ofs;
+            status = tinfl_decompress(&inflator,
+                                      (const mz_uint8 *)comp_buf + in_ofs, &in_bytes,
+                                      dict, dict + dict_ofs, &out_bytes,
+                                      TINFL_FLAG_PARSE_ZLIB_HEADER |
+                                      (more_input ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+            in_ofs += in_bytes;
+
+            if (out_bytes > 0) {
+                // 哈希和落盘都针对解压后的明文
+                dl_hash_update(&hash_ctx, dict + dict_ofs, out_bytes);
+                if (fwrite(dict + dict_ofs, 1, out_bytes, fp) != out_bytes) {
+                    ESP_LOGE(TAG, "文件写入错误");
+                    result = ESP_FAIL;
+                    break;
+                }
+                decomp_total += out_bytes;
+                dict_ofs = (dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+            }
+
+            if (status < 0) {
+                ESP_LOGE(TAG, "解压失败: 状态=%d, 压缩偏移%d", status, comp_read);
+                result = ESP_FAIL;
+                break;
+            }
+
+            int percent = (file_size > 0) ? (decomp_total * 100) / file_size : 0;
+            if (percent - last_percent >= 10) {
+                send_progress_notification("download_progress", filename, percent,
+                                           decomp_total, file_size);
+                last_percent = percent;
+            }
+        } while (status == TINFL_STATUS_HAS_MORE_OUTPUT ||
+                 (in_ofs < (size_t)read_len && status != TINFL_STATUS_DONE));
+
+        if (result != ESP_OK) {
+            break;
+        }
+    }
+
+    int status_code = esp_http_client_get_status_code(http_client);
+    // 解压在收完整个压缩体之前就出错时，连接上还有残余数据，不可复用
+    http_pool_release(http_client, status_code == 200 && comp_read == content_length);
+    fclose(fp);
+    free(comp_buf);
+    free(dict);
+
+    char calculated_hash[65];
+    dl_hash_finish(&hash_ctx, calculated_hash);
+    dl_hash_free(&hash_ctx);
+
+    if (result != ESP_OK || status_code != 200 ||
+        status != TINFL_STATUS_DONE || decomp_total != file_size) {
+        ESP_LOGE(TAG, "压缩下载失败: 状态码=%d, 解压%d/%d字节",
+                 status_code, decomp_total, file_size);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    if (strcmp(calculated_hash, expected_hash) != 0) {
+        ESP_LOGE(TAG, "%s校验失败(明文): 计算值=%s, 期望值=%s",
+                 hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5",
+                 calculated_hash, expected_hash);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    unlink(file_path);
+    if (rename(tmp_path, file_path) != 0) {
+        ESP_LOGE(TAG, "提交文件失败: %s", strerror(errno));
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "压缩下载完成: %s, 压缩%d字节 -> 明文%d字节",
+             short_filename, comp_read, decomp_total);
+    send_progress_notification("download_progress", filename, 100, decomp_total, file_size);
+    send_download_complete(short_filename, hash_type == DL_HASH_SHA256 ? "sha256" : "md5",
+                           calculated_hash);
+
+    // 写入持久化文件索引并激活
+    file_info_t info = { .size = decomp_total, .active = 1 };
+    strncpy(info.filename, short_filename, sizeof(info.filename) - 1);
+    info.filename[sizeof(info.filename) - 1] = '\0';
+    strncpy(info.md5, calculated_hash, sizeof(info.md5) - 1);
+    info.md5[sizeof(info.md5) - 1] = '\0';
+    strncpy(info.logical, filename, sizeof(info.logical) - 1);
+    info.logical[sizeof(info.logical) - 1] = '\0';
+    info.timestamp = esp_timer_get_time() / 1000000;
+    info.last_access = info.timestamp;
+    info.pinned = 0;
+
+    xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+    file_index_deactivate_others(&info);
+    bool added = file_index_add(&info);
+    xSemaphoreGive(file_list_mutex);
+
+    if (added) {
+        send_file_list_delta(&info);
+    }
+
+    return ESP_OK;
 }
 
 // 下载文件
-static esp_err_t download_file(const char *url, const char *filename, const char *expected_md5, int file_size)
+static esp_err_t download_file(const char *url, const char *filename, const char *expected_md5, const char *expected_sha256, int file_size, const char *content_encoding, int rate_limit_kbps)
 {
-    esp_http_client_config_t config = {
-        .url = url,
-        .event_handler = http_event_handler,
-        // 添加超时设置，避免下载卡住
-        .timeout_ms = 10000,
-    };
-    
-    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    // 协商校验算法：服务器携带sha256字段时走硬件SHA-256，否则回退软件MD5
+    dl_hash_type_t hash_type = (expected_sha256 != NULL) ? DL_HASH_SHA256 : DL_HASH_MD5;
+    const char *expected_hash = (expected_sha256 != NULL) ? expected_sha256 : expected_md5;
+
+    // 从连接池取客户端：同主机的顺序传输复用已建立的连接
+    esp_http_client_handle_t http_client = http_pool_acquire(url);
     if (http_client == NULL) {
         ESP_LOGE(TAG, "HTTP客户端初始化失败");
         return ESP_FAIL;
@@ -645,7 +3225,7 @@ static esp_err_t download_file(const char *url, const char *filename, const char
     esp_err_t ret = esp_spiffs_info("spiffs", &total, &used);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "无法获取SPIFFS信息: %s", esp_err_to_name(ret));
-        esp_http_client_cleanup(http_client);
+        http_pool_release(http_client, true); // 连接尚未使用，可以留在池里
         return ret;
     }
     
@@ -653,39 +3233,11 @@ static esp_err_t download_file(const char *url, const char *filename, const char
     ESP_LOGI(TAG, "SPIFFS可用空间: %d字节, 需要空间: %d字节", free_space, file_size);
     
     if (free_space < file_size) {
-        ESP_LOGE(TAG, "SPIFFS空间不足，可用: %d字节, 需要: %d字节", free_space, file_size);
-        
-        // 尝试删除一些文件以释放空间
-        ESP_LOGI(TAG, "尝试删除旧文件释放空间...");
-        DIR *dir = opendir("/spiffs");
-        if (dir) {
-            struct dirent *entry;
-            while ((entry = readdir(dir)) != NULL) {
-                char file_path[64]; // 使用更小的缓冲区
-                if (strlen(entry->d_name) < 30) { // 限制更短的文件名
-                    snprintf(file_path, sizeof(file_path), "/spiffs/%s", entry->d_name);
-                    
-                    ESP_LOGI(TAG, "删除文件: %s", file_path);
-                    unlink(file_path);
-                    
-                    // 重新检查空间
-                    esp_spiffs_info("spiffs", &total, &used);
-                    free_space = total - used;
-                    if (free_space >= file_size) {
-                        ESP_LOGI(TAG, "已释放足够空间: %d字节", free_space);
-                        break;
-                    }
-                } else {
-                    ESP_LOGW(TAG, "文件名过长，跳过: %.10s...", entry->d_name);
-                }
-            }
-            closedir(dir);
-        }
-        
-        // 再次检查空间
-        if (free_space < file_size) {
-            ESP_LOGE(TAG, "释放空间后仍然不足，无法下载文件");
-            esp_http_client_cleanup(http_client);
+        // 按最久未访问优先淘汰非固定文件，固定（pinned）文件不会被删除
+        ESP_LOGI(TAG, "SPIFFS空间不足，启动淘汰...");
+        if (evict_for_space(file_size) != ESP_OK) {
+            ESP_LOGE(TAG, "淘汰后空间仍然不足，无法下载文件");
+            http_pool_release(http_client, true);
             return ESP_ERR_NO_MEM;
         }
     }
@@ -694,92 +3246,232 @@ static esp_err_t download_file(const char *url, const char *filename, const char
     const char *ext = strrchr(filename, '.');
     if (!ext) ext = ""; // 如果没有扩展名
     
-    // 生成短文件名：使用MD5的前8位 + 扩展名
+    // 生成短文件名：使用校验哈希的前8位 + 扩展名
     char short_filename[32];
     if (strlen(ext) > 0) {
-        snprintf(short_filename, sizeof(short_filename), "f_%8.8s%s", expected_md5, ext);
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s%s", expected_hash, ext);
     } else {
-        snprintf(short_filename, sizeof(short_filename), "f_%8.8s", expected_md5);
+        snprintf(short_filename, sizeof(short_filename), "f_%8.8s", expected_hash);
     }
     
     ESP_LOGI(TAG, "使用短文件名: %s (原名: %s)", short_filename, filename);
     
     char file_path[64]; // 减小缓冲区大小
     snprintf(file_path, sizeof(file_path), "/spiffs/%s", short_filename);
-    
-    FILE *f = fopen(file_path, "wb");
+
+    // 断点状态文件与数据文件同名，加".rs"后缀
+    char state_path[72];
+    snprintf(state_path, sizeof(state_path), "%s.rs", file_path);
+
+    // 流式写入落在暂存槽，整体校验通过后才原子改名为正式路径
+    char tmp_path[72];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", file_path);
+
+    // 压缩传输走专用的流式解压路径（不支持续传/暂存/并行）
+    if (content_encoding != NULL && strcmp(content_encoding, "deflate") == 0) {
+        return download_file_deflate(http_client, file_path, short_filename,
+                                     filename, expected_hash, hash_type, file_size);
+    }
+
+    // 小文件优先尝试PSRAM整文件暂存路径：校验通过才写flash
+    if (file_size <= DL_STAGE_MAX_SIZE) {
+        esp_err_t staged = download_file_staged(http_client, file_path, short_filename,
+                                                filename, expected_hash, hash_type, file_size,
+                                                rate_limit_kbps);
+        if (staged != ESP_ERR_NOT_SUPPORTED) {
+            if (staged == ESP_OK) {
+                unlink(state_path); // 清理可能残留的断点状态
+            }
+            return staged;
+        }
+        // PSRAM不可用，继续走流式下载路径
+        ESP_LOGD(TAG, "PSRAM不可用，使用流式下载");
+    }
+
+    // 大文件尝试多连接并行Range下载（需要PSRAM容纳整个文件）。
+    // 服务器要求限速时不开并行——多条连接会绕开速率整形
+    if (file_size > DL_STAGE_MAX_SIZE && rate_limit_kbps <= 0) {
+        esp_err_t par = download_file_parallel(url, file_path, short_filename, filename,
+                                               expected_hash, hash_type, file_size);
+        if (par != ESP_ERR_NOT_SUPPORTED) {
+            http_pool_release(http_client, true); // 并行路径用自己的连接
+
+            if (par == ESP_OK) {
+                unlink(state_path); // 清理可能残留的断点状态
+            }
+            return par;
+        }
+        // PSRAM不足或服务器不支持Range，退回单连接流式路径
+        ESP_LOGD(TAG, "并行下载不可用，使用流式下载");
+    }
+
+    // 尝试加载断点续传状态
+    dl_resume_state_t resume_state;
+    int resume_offset = 0;
+    if (load_resume_state(state_path, expected_hash, hash_type, file_size, &resume_state)) {
+        resume_offset = resume_state.received;
+        ESP_LOGI(TAG, "发现断点状态，从偏移 %d 继续下载", resume_offset);
+    } else {
+        resume_state.magic = DL_RESUME_MAGIC;
+        resume_state.file_size = file_size;
+        resume_state.received = 0;
+        strncpy(resume_state.expected_hash, expected_hash, sizeof(resume_state.expected_hash) - 1);
+        resume_state.expected_hash[sizeof(resume_state.expected_hash) - 1] = '\0';
+    }
+
+    // 续传时以"r+b"打开暂存槽并定位到断点，否则新建
+    FILE *f = fopen(tmp_path, resume_offset > 0 ? "r+b" : "wb");
+    if (f == NULL && resume_offset > 0) {
+        // 暂存数据丢失但状态文件还在，退回完整下载
+        ESP_LOGW(TAG, "断点数据文件丢失，重新下载");
+        unlink(state_path);
+        resume_offset = 0;
+        resume_state.received = 0;
+        f = fopen(tmp_path, "wb");
+    }
     if (f == NULL) {
-        ESP_LOGE(TAG, "无法创建文件: %s, 错误: %s", file_path, strerror(errno));
-        esp_http_client_cleanup(http_client);
+        ESP_LOGE(TAG, "无法创建文件: %s, 错误: %s", tmp_path, strerror(errno));
+        http_pool_release(http_client, true);
         return ESP_FAIL;
     }
-    
+
+    if (resume_offset > 0) {
+        fseek(f, resume_offset, SEEK_SET);
+        // 请求从断点偏移开始的剩余部分
+        char range_header[32];
+        snprintf(range_header, sizeof(range_header), "bytes=%d-", resume_offset);
+        esp_http_client_set_header(http_client, "Range", range_header);
+    }
+
     // 开始HTTP请求
     esp_err_t err = esp_http_client_open(http_client, 0);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "HTTP请求失败: %s", esp_err_to_name(err));
         fclose(f);
-        esp_http_client_cleanup(http_client);
+        http_pool_release(http_client, false);
         return err;
     }
-    
+
     int content_length = esp_http_client_fetch_headers(http_client);
-    ESP_LOGI(TAG, "文件大小: %d字节", content_length);
-    
-    // 文件大小检查
-    if (content_length <= 0 || content_length > MAX_FILE_SIZE) {
+    ALOG(LOG_SUBSYS_TRANSFER, ESP_LOG_INFO, "本次传输大小: %ld字节", content_length, 0);
+
+    // 续传请求必须得到206响应，否则服务器不支持Range，退回完整下载
+    if (resume_offset > 0 && esp_http_client_get_status_code(http_client) != 206) {
+        ESP_LOGW(TAG, "服务器不支持Range请求，重新完整下载");
+        resume_offset = 0;
+        resume_state.received = 0;
+        rewind(f);
+    }
+
+    // 文件大小检查（含已下载部分）
+    if (content_length <= 0 || resume_offset + content_length > MAX_FILE_SIZE) {
         ESP_LOGE(TAG, "文件大小无效或过大: %d", content_length);
         fclose(f);
-        esp_http_client_cleanup(http_client);
+        http_pool_release(http_client, false); // 响应体未读，不可复用
         return ESP_ERR_INVALID_SIZE;
     }
-    
-    // 计算MD5散列
-    mbedtls_md5_context md5_ctx;
-    mbedtls_md5_init(&md5_ctx);
-    mbedtls_md5_starts(&md5_ctx);
-    
-    // 设置适当的缓冲区大小，降低内存使用
-    char *buffer = malloc(BUFFER_SIZE);
-    if (!buffer) {
-        ESP_LOGE(TAG, "内存分配失败");
+    int content_total = resume_offset + content_length;
+
+    // 计算校验哈希，续传时恢复上次保存的上下文
+    dl_hash_ctx_t hash_ctx;
+    if (resume_offset > 0) {
+        hash_ctx = resume_state.hash_ctx;
+    } else {
+        dl_hash_starts(&hash_ctx, hash_type);
+    }
+
+    // 分配双缓冲区：读取任务填充其中一个时，写入任务可并行刷写另一个
+    // 优先从PSRAM分配大块缓冲区，两块大小可能不同时取较小者为读取单位
+    char *pipe_buffers[DL_PIPE_BUF_COUNT] = {NULL};
+    size_t xfer_buf_size = PSRAM_BUFFER_SIZE;
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        size_t this_size;
+        pipe_buffers[i] = transfer_buf_alloc(&this_size);
+        if (!pipe_buffers[i]) {
+            ESP_LOGE(TAG, "内存分配失败");
+            for (int j = 0; j < i; j++) {
+                transfer_buf_free(pipe_buffers[j]);
+            }
+            fclose(f);
+            http_pool_release(http_client, false);
+            dl_hash_free(&hash_ctx);
+            return ESP_ERR_NO_MEM;
+        }
+        if (this_size < xfer_buf_size) {
+            xfer_buf_size = this_size;
+        }
+    }
+    ESP_LOGI(TAG, "传输缓冲区: %d字节 x %d", xfer_buf_size, DL_PIPE_BUF_COUNT);
+
+    // 建立下载流水线
+    dl_pipeline_t pipeline = {
+        .fp = f,
+        .hash_ctx = &hash_ctx,
+        .filled_queue = xQueueCreate(DL_PIPE_BUF_COUNT, sizeof(dl_pipe_buf_t)),
+        .free_queue = xQueueCreate(DL_PIPE_BUF_COUNT, sizeof(char *)),
+        .write_result = ESP_OK,
+        .done_sem = xSemaphoreCreateBinary(),
+        .resume = &resume_state,
+        .state_path = state_path,
+        .last_checkpoint = resume_offset,
+    };
+
+    if (pipeline.filled_queue == NULL || pipeline.free_queue == NULL || pipeline.done_sem == NULL ||
+        xTaskCreatePinnedToCore(dl_writer_task, "dl_writer", DL_WRITER_TASK_STACK_SIZE, &pipeline,
+                                WS_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+        ESP_LOGE(TAG, "创建下载流水线失败");
+        if (pipeline.filled_queue) vQueueDelete(pipeline.filled_queue);
+        if (pipeline.free_queue) vQueueDelete(pipeline.free_queue);
+        if (pipeline.done_sem) vSemaphoreDelete(pipeline.done_sem);
+        for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+            free(pipe_buffers[i]);
+        }
         fclose(f);
-        esp_http_client_cleanup(http_client);
-        mbedtls_md5_free(&md5_ctx);
-        return ESP_ERR_NO_MEM;
+        http_pool_release(http_client, false);
+        dl_hash_free(&hash_ctx);
+        return ESP_FAIL;
     }
-    
-    // 下载文件内容
-    int total_read = 0;
+
+    // 初始时所有缓冲区都空闲
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        xQueueSend(pipeline.free_queue, &pipe_buffers[i], portMAX_DELAY);
+    }
+
+    // 下载文件内容：本任务只负责HTTP读取，写入由dl_writer_task并行完成
+    int total_read = resume_offset;
     int read_len;
-    
+
     int last_percent = 0;
     int last_update_time = 0;
     int64_t current_time;
-    
-    while (1) {
-        read_len = esp_http_client_read(http_client, buffer, BUFFER_SIZE);
+
+    dl_pacer_t pacer;
+    dl_pacer_init(&pacer, rate_limit_kbps);
+
+    while (pipeline.write_result == ESP_OK) {
+        char *buffer;
+        xQueueReceive(pipeline.free_queue, &buffer, portMAX_DELAY);
+
+        int64_t read_start = esp_timer_get_time();
+        read_len = esp_http_client_read(http_client, buffer, xfer_buf_size);
+        STAT_ADD(net_read_us, esp_timer_get_time() - read_start);
         if (read_len <= 0) {
+            // 归还未使用的缓冲区后结束读取
+            xQueueSend(pipeline.free_queue, &buffer, portMAX_DELAY);
             break;
         }
-        
-        // 写入文件
-        size_t written = fwrite(buffer, 1, read_len, f);
-        if (written != read_len) {
-            ESP_LOGE(TAG, "文件写入错误: %d != %d", written, read_len);
-            free(buffer);
-            fclose(f);
-            esp_http_client_cleanup(http_client);
-            mbedtls_md5_free(&md5_ctx);
-            return ESP_FAIL;
-        }
-        
-        // 更新MD5散列
-        mbedtls_md5_update(&md5_ctx, (const unsigned char *)buffer, read_len);
-        
+
+        // 按服务器限速提示整形（未限速时为空操作）
+        dl_pacer_consume(&pacer, read_len);
+
+        // 交给写入任务
+        dl_pipe_buf_t pipe_buf = { .data = buffer, .len = read_len };
+        xQueueSend(pipeline.filled_queue, &pipe_buf, portMAX_DELAY);
+
+        STAT_ADD(bytes_downloaded, read_len);
         total_read += read_len;
         // 计算下载百分比
-        int percent = (total_read * 100) / content_length;
+        int percent = (total_read * 100) / content_total;
            
         // 发送进度通知到服务器
         // 修改进度更新逻辑，减少更新频率，避免栈溢出
@@ -791,59 +3483,101 @@ static esp_err_t download_file(const char *url, const char *filename, const char
             percent != last_percent) {
             
             // 使用简化的进度通知函数
-            send_progress_notification("download_progress", filename, percent, total_read, content_length);
+            send_progress_notification("download_progress", filename, percent, total_read, content_total);
             
             last_percent = percent;
             last_update_time = current_time;
         }
     }
-    
-    
-    
-    free(buffer);
+
+    // 发送结束标记并等待写入任务刷完剩余缓冲区
+    dl_pipe_buf_t end_buf = { .data = NULL, .len = 0 };
+    xQueueSend(pipeline.filled_queue, &end_buf, portMAX_DELAY);
+    xSemaphoreTake(pipeline.done_sem, portMAX_DELAY);
+
+    esp_err_t write_result = pipeline.write_result;
+    vQueueDelete(pipeline.filled_queue);
+    vQueueDelete(pipeline.free_queue);
+    vSemaphoreDelete(pipeline.done_sem);
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        transfer_buf_free(pipe_buffers[i]);
+    }
     fclose(f);
-    
-    // 完成MD5计算
-    unsigned char md5_result[16];
-    char calculated_md5[33];
-    mbedtls_md5_finish(&md5_ctx, md5_result);
-    mbedtls_md5_free(&md5_ctx);
-    
-    // 转换为十六进制字符串
-    for (int i = 0; i < 16; i++) {
-        sprintf(calculated_md5 + i * 2, "%02x", md5_result[i]);
+
+    if (write_result != ESP_OK) {
+        http_pool_release(http_client, false);
+        dl_hash_free(&hash_ctx);
+        return write_result;
     }
-    calculated_md5[32] = '\0';
-    
+
+    // 传输中断：保存最终断点状态，等待下次通知时续传
+    if (total_read < content_total) {
+        ESP_LOGW(TAG, "下载中断: %d/%d字节，已保存断点状态", total_read, content_total);
+        resume_state.received = total_read;
+        resume_state.hash_ctx = hash_ctx;
+        save_resume_state(state_path, &resume_state);
+        http_pool_release(http_client, false); // 传输中断，连接状态不可信
+        dl_hash_free(&hash_ctx);
+        return ESP_FAIL;
+    }
+
+    // 完成哈希计算
+    char calculated_hash[65];
+    dl_hash_finish(&hash_ctx, calculated_hash);
+    dl_hash_free(&hash_ctx);
+
     int status_code = esp_http_client_get_status_code(http_client);
     ESP_LOGI(TAG, "HTTP状态码: %d", status_code);
-    esp_http_client_cleanup(http_client);
+    // 响应体已读完，连接可留在池里供下一个文件复用
+    http_pool_release(http_client, status_code == 200 || status_code == 206);
     
-    if (status_code == 200) {
+    if (status_code == 200 || status_code == 206) {
         ESP_LOGI(TAG, "文件下载完成，总大小: %d字节", total_read);
-        ESP_LOGI(TAG, "计算的MD5: %s", calculated_md5);
-        ESP_LOGI(TAG, "预期的MD5: %s", expected_md5);
-        
-        // 验证MD5
-        if (strcmp(calculated_md5, expected_md5) == 0) {
-            ESP_LOGI(TAG, "MD5校验成功");
-        } else {
-            ESP_LOGW(TAG, "MD5校验失败，可能文件已损坏");
+        ESP_LOGI(TAG, "计算的%s: %s", hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5", calculated_hash);
+        ESP_LOGI(TAG, "预期的%s: %s", hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5", expected_hash);
+
+        // 下载完整后断点状态不再需要
+        unlink(state_path);
+
+        // 验证哈希：失败的内容绝不激活，暂存槽直接丢弃
+        if (strcmp(calculated_hash, expected_hash) != 0) {
+            ESP_LOGE(TAG, "%s校验失败，丢弃暂存内容", hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5");
+            unlink(tmp_path);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "%s校验成功", hash_type == DL_HASH_SHA256 ? "SHA256" : "MD5");
+
+        // 原子改名激活新内容
+        unlink(file_path);
+        if (rename(tmp_path, file_path) != 0) {
+            ESP_LOGE(TAG, "提交文件失败: %s", strerror(errno));
+            unlink(tmp_path);
+            return ESP_FAIL;
         }
         
         // 发送下载完成通知，传递短文件名和原始文件名
-        send_download_complete(short_filename, calculated_md5);
+        send_download_complete(short_filename, hash_type == DL_HASH_SHA256 ? "sha256" : "md5", calculated_hash);
         
-        // 保存文件到文件列表中
-        if (file_count < MAX_FILES) {
-            strncpy(device_files[file_count].filename, short_filename, sizeof(device_files[file_count].filename) - 1);
-            device_files[file_count].size = total_read;
-            strncpy(device_files[file_count].md5, calculated_md5, sizeof(device_files[file_count].md5) - 1);
-            device_files[file_count].timestamp = esp_timer_get_time() / 1000000; // 当前时间（秒）
-            file_count++;
-            
-            // 更新服务器上的文件列表
-            send_file_list();
+        // 写入持久化文件索引（多个下载工作任务并发更新，需要加锁）
+        file_info_t info = { .size = total_read, .active = 1 };
+        strncpy(info.filename, short_filename, sizeof(info.filename) - 1);
+        info.filename[sizeof(info.filename) - 1] = '\0';
+        strncpy(info.md5, calculated_hash, sizeof(info.md5) - 1);
+        info.md5[sizeof(info.md5) - 1] = '\0';
+        strncpy(info.logical, filename, sizeof(info.logical) - 1);
+        info.logical[sizeof(info.logical) - 1] = '\0';
+        info.timestamp = esp_timer_get_time() / 1000000; // 当前时间（秒）
+        info.last_access = info.timestamp;
+        info.pinned = 0;
+
+        xSemaphoreTake(file_list_mutex, portMAX_DELAY);
+        file_index_deactivate_others(&info);
+        bool added = file_index_add(&info);
+        xSemaphoreGive(file_list_mutex);
+
+        if (added) {
+            // 只上报变化的条目，不重发完整清单
+            send_file_list_delta(&info);
         }
         
         return ESP_OK;
@@ -853,65 +3587,105 @@ static esp_err_t download_file(const char *url, const char *filename, const char
     }
 }
 
-// 发送下载完成通知
-static void send_download_complete(const char *filename, const char *md5)
+// 发送下载完成通知，hash_key为"md5"或"sha256"，与协商的校验算法一致
+static void send_download_complete(const char *filename, const char *hash_key, const char *hash)
 {
     // 使用静态缓冲区减少栈使用
     static char json_buffer[256];
     
     // 直接格式化JSON字符串
     snprintf(json_buffer, sizeof(json_buffer),
-             "{\"type\":\"download_complete\",\"status\":\"success\",\"data\":{\"filename\":\"%s\",\"md5\":\"%s\"}}",
-             filename, md5);
+             "{\"type\":\"download_complete\",\"status\":\"success\",\"data\":{\"filename\":\"%s\",\"%s\":\"%s\"}}",
+             filename, hash_key, hash);
     
     ESP_LOGI(TAG, "发送下载完成通知: %s", json_buffer);
     
-    esp_websocket_client_send_text(client, json_buffer, strlen(json_buffer), portMAX_DELAY);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
 }
 
 // 处理上传请求
 static void handle_upload_request(const char *message)
 {
-    cJSON *root = cJSON_Parse(message);
-    if (!root) {
-        ESP_LOGE(TAG, "解析上传请求JSON失败");
-        return;
-    }
+    char filename[64];
+    char url[192];
     
-    cJSON *data = cJSON_GetObjectItem(root, "data");
-    if (data) {
-        char *filename = NULL;
-        char *url = NULL;
-        
-        cJSON *json_filename = cJSON_GetObjectItem(data, "filename");
-        cJSON *json_url = cJSON_GetObjectItem(data, "url");
-        
-        if (json_filename && json_filename->valuestring) filename = json_filename->valuestring;
-        if (json_url && json_url->valuestring) url = json_url->valuestring;
-        
-        if (filename && url) {
-            ESP_LOGI(TAG, "收到上传请求: 文件=%s, URL=%s", filename, url);
-            
-            // 发送上传确认 - 使用静态缓冲区
-            static char ack_buffer[256];
-            snprintf(ack_buffer, sizeof(ack_buffer),
-                    "{\"type\":\"upload_ack\",\"status\":\"success\",\"message\":\"开始上传文件\",\"data\":{\"filename\":\"%s\"}}",
-                    filename);
-            
-            ESP_LOGI(TAG, "发送上传确认: %s", ack_buffer);
-            esp_websocket_client_send_text(client, ack_buffer, strlen(ack_buffer), portMAX_DELAY);
-            
-            // 开始上传文件
-            esp_err_t ret = upload_file(filename, url);
-            if (ret != ESP_OK) {
-                ESP_LOGE(TAG, "文件上传失败");
-            }
-        } else {
-            ESP_LOGE(TAG, "上传请求缺少必要字段");
+    // 已知schema，直接扫描字段，解析失败时回退cJSON
+    bool has_fields = json_extract_string(message, "filename", filename, sizeof(filename)) &&
+                      json_extract_string(message, "url", url, sizeof(url));
+    if (!has_fields) {
+        cJSON *root = cJSON_Parse(message);
+        if (!root) {
+            ESP_LOGE(TAG, "解析上传请求JSON失败");
+            return;
+        }
+        cJSON *data = cJSON_GetObjectItem(root, "data");
+        cJSON *json_filename = data ? cJSON_GetObjectItem(data, "filename") : NULL;
+        cJSON *json_url = data ? cJSON_GetObjectItem(data, "url") : NULL;
+        if (json_filename && json_filename->valuestring && json_url && json_url->valuestring &&
+            strlen(json_filename->valuestring) < sizeof(filename) &&
+            strlen(json_url->valuestring) < sizeof(url)) {
+            strcpy(filename, json_filename->valuestring);
+            strcpy(url, json_url->valuestring);
+            has_fields = true;
         }
+        cJSON_Delete(root);
     }
     
-    cJSON_Delete(root);
+    if (has_fields) {
+        ESP_LOGI(TAG, "收到上传请求: 文件=%s, URL=%s", filename, url);
+
+        // 发送上传确认 - 使用静态缓冲区
+        static char ack_buffer[256];
+        snprintf(ack_buffer, sizeof(ack_buffer),
+                "{\"type\":\"upload_ack\",\"status\":\"success\",\"message\":\"开始上传文件\",\"data\":{\"filename\":\"%s\"}}",
+                filename);
+
+        ESP_LOGI(TAG, "发送上传确认: %s", ack_buffer);
+        tx_enqueue_reliable(false, ack_buffer, strlen(ack_buffer));
+
+        // 开始上传文件
+        esp_err_t ret = upload_file(filename, url);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "文件上传失败");
+        }
+    } else {
+        ESP_LOGE(TAG, "上传请求缺少必要字段");
+    }
+}
+
+// 上传预读上下文：预读任务从SPIFFS提前读取下一块，主循环同时向socket写入
+typedef struct {
+    FILE *fp;                    // 源文件
+    size_t chunk_size;           // 每块读取大小
+    QueueHandle_t filled_queue;  // 已填充缓冲区队列（预读->写入）
+    QueueHandle_t free_queue;    // 空闲缓冲区队列（写入->预读）
+    volatile bool abort_read;    // 写入失败时置位，预读任务尽快退出
+    SemaphoreHandle_t done_sem;  // 预读任务退出信号
+} ul_prefetch_t;
+
+// 上传预读任务：SPIFFS顺序读延迟与socket写入重叠，
+// len为0的块作为文件结束标记发给写入端
+static void ul_reader_task(void *pvParameter)
+{
+    ul_prefetch_t *pf = (ul_prefetch_t *)pvParameter;
+    char *buffer;
+
+    while (!pf->abort_read) {
+        if (xQueueReceive(pf->free_queue, &buffer, 100 / portTICK_PERIOD_MS) != pdTRUE) {
+            continue;
+        }
+
+        size_t read_len = fread(buffer, 1, pf->chunk_size, pf->fp);
+        dl_pipe_buf_t buf = { .data = buffer, .len = (int)read_len };
+        xQueueSend(pf->filled_queue, &buf, portMAX_DELAY);
+
+        if (read_len == 0) {
+            break;
+        }
+    }
+
+    xSemaphoreGive(pf->done_sem);
+    vTaskDelete(NULL);
 }
 
 // 上传文件
@@ -941,20 +3715,18 @@ static esp_err_t upload_file(const char *filename, const char *url)
     
     ESP_LOGI(TAG, "开始上传文件: %s, 大小: %ld字节", filename, file_size);
     
-    // 配置HTTP客户端进行POST请求
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        // 添加超时设置，避免上传卡住
-        .timeout_ms = 30000,
-    };
+    // 记录访问时间，供淘汰引擎参考
+    file_index_touch(filename);
     
-    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    // 从连接池取客户端做POST请求（句柄可能复用自之前的下载）
+    esp_http_client_handle_t http_client = http_pool_acquire(url);
     if (http_client == NULL) {
         ESP_LOGE(TAG, "HTTP客户端初始化失败");
         fclose(f);
         return ESP_FAIL;
     }
+    esp_http_client_set_method(http_client, HTTP_METHOD_POST);
+    esp_http_client_set_timeout_ms(http_client, 30000);
     
     // 设置HTTP头
     esp_http_client_set_header(http_client, "Content-Type", "application/octet-stream");
@@ -968,7 +3740,7 @@ static esp_err_t upload_file(const char *filename, const char *url)
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "HTTP请求失败: %s", esp_err_to_name(err));
         fclose(f);
-        esp_http_client_cleanup(http_client);
+        http_pool_release(http_client, false);
         return err;
     }
     
@@ -977,38 +3749,88 @@ static esp_err_t upload_file(const char *filename, const char *url)
     mbedtls_md5_init(&md5_ctx);
     mbedtls_md5_starts(&md5_ctx);
     
-    // 设置适当的缓冲区大小，降低内存使用
-    char *buffer = malloc(BUFFER_SIZE);
-    if (!buffer) {
-        ESP_LOGE(TAG, "内存分配失败");
+    // 分配双缓冲区，预读任务与socket写入各占一个
+    char *ul_buffers[DL_PIPE_BUF_COUNT] = {NULL};
+    size_t xfer_buf_size = PSRAM_BUFFER_SIZE;
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        size_t this_size;
+        ul_buffers[i] = transfer_buf_alloc(&this_size);
+        if (!ul_buffers[i]) {
+            ESP_LOGE(TAG, "内存分配失败");
+            for (int j = 0; j < i; j++) {
+                transfer_buf_free(ul_buffers[j]);
+            }
+            fclose(f);
+            http_pool_release(http_client, false);
+            mbedtls_md5_free(&md5_ctx);
+            return ESP_ERR_NO_MEM;
+        }
+        if (this_size < xfer_buf_size) {
+            xfer_buf_size = this_size;
+        }
+    }
+
+    // 建立预读流水线
+    ul_prefetch_t prefetch = {
+        .fp = f,
+        .chunk_size = xfer_buf_size,
+        .filled_queue = xQueueCreate(DL_PIPE_BUF_COUNT, sizeof(dl_pipe_buf_t)),
+        .free_queue = xQueueCreate(DL_PIPE_BUF_COUNT, sizeof(char *)),
+        .abort_read = false,
+        .done_sem = xSemaphoreCreateBinary(),
+    };
+
+    if (prefetch.filled_queue == NULL || prefetch.free_queue == NULL || prefetch.done_sem == NULL ||
+        xTaskCreatePinnedToCore(ul_reader_task, "ul_reader", UL_READER_TASK_STACK_SIZE, &prefetch,
+                                WS_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+        ESP_LOGE(TAG, "创建上传预读任务失败");
+        if (prefetch.filled_queue) vQueueDelete(prefetch.filled_queue);
+        if (prefetch.free_queue) vQueueDelete(prefetch.free_queue);
+        if (prefetch.done_sem) vSemaphoreDelete(prefetch.done_sem);
+        for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+            transfer_buf_free(ul_buffers[i]);
+        }
         fclose(f);
-        esp_http_client_cleanup(http_client);
+        http_pool_release(http_client, false);
         mbedtls_md5_free(&md5_ctx);
-        return ESP_ERR_NO_MEM;
+        return ESP_FAIL;
     }
-    
-    // 上传文件内容
+
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        xQueueSend(prefetch.free_queue, &ul_buffers[i], portMAX_DELAY);
+    }
+
+    // 上传文件内容：预读任务提前准备下一块，本循环只负责socket写入
     int total_write = 0;
-    size_t read_len;
+    esp_err_t upload_err = ESP_OK;
     
     int last_percent = 0;
     int last_update_time = 0;
     int64_t current_time;
     
-    while ((read_len = fread(buffer, 1, BUFFER_SIZE, f)) > 0) {
-        int write_len = esp_http_client_write(http_client, buffer, read_len);
+    while (1) {
+        dl_pipe_buf_t buf;
+        xQueueReceive(prefetch.filled_queue, &buf, portMAX_DELAY);
+        if (buf.len == 0) {
+            // 文件读取完毕
+            break;
+        }
+        
+        int write_len = esp_http_client_write(http_client, buf.data, buf.len);
         if (write_len < 0) {
             ESP_LOGE(TAG, "HTTP写入错误");
-            free(buffer);
-            fclose(f);
-            esp_http_client_cleanup(http_client);
-            mbedtls_md5_free(&md5_ctx);
-            return ESP_FAIL;
+            prefetch.abort_read = true;
+            upload_err = ESP_FAIL;
+            xQueueSend(prefetch.free_queue, &buf.data, portMAX_DELAY);
+            break;
         }
         
         // 更新MD5散列
-        mbedtls_md5_update(&md5_ctx, (const unsigned char *)buffer, read_len);
+        mbedtls_md5_update(&md5_ctx, (const unsigned char *)buf.data, buf.len);
         
+        xQueueSend(prefetch.free_queue, &buf.data, portMAX_DELAY);
+        
+        STAT_ADD(bytes_uploaded, write_len);
         total_write += write_len;
         int percent = (total_write * 100) / file_size;
     
@@ -1029,13 +3851,29 @@ static esp_err_t upload_file(const char *filename, const char *url)
         }
     }
     
+    // 等待预读任务退出后再回收流水线资源
+    prefetch.abort_read = true;
+    xSemaphoreTake(prefetch.done_sem, portMAX_DELAY);
+    vQueueDelete(prefetch.filled_queue);
+    vQueueDelete(prefetch.free_queue);
+    vSemaphoreDelete(prefetch.done_sem);
+
+    if (upload_err != ESP_OK) {
+        for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+            transfer_buf_free(ul_buffers[i]);
+        }
+        fclose(f);
+        http_pool_release(http_client, false);
+        mbedtls_md5_free(&md5_ctx);
+        return upload_err;
+    }
+
     // 确保最终进度为100%
     if (last_percent != 100 && total_write == file_size) {
         // 发送100%进度通知
         send_progress_notification("upload_progress", filename, 100, total_write, file_size);
     }
     
-
     // 完成MD5计算
     unsigned char md5_result[16];
     char calculated_md5[33];
@@ -1048,18 +3886,25 @@ static esp_err_t upload_file(const char *filename, const char *url)
     }
     calculated_md5[32] = '\0';
     
-    // 获取服务器响应
-    int data_read = esp_http_client_read_response(http_client, buffer, sizeof(buffer) - 1);
+    // 获取服务器响应（复用第一块传输缓冲区，按真实容量读取——
+    // 之前这里对指针取sizeof，实际只读了3字节）
+    char *resp_buf = ul_buffers[0];
+    int data_read = esp_http_client_read_response(http_client, resp_buf, xfer_buf_size - 1);
     if (data_read >= 0) {
-        buffer[data_read] = 0;
-        ESP_LOGI(TAG, "服务器响应: %s", buffer);
+        resp_buf[data_read] = 0;
+        ESP_LOGI(TAG, "服务器响应: %s", resp_buf);
     }
     
     int status_code = esp_http_client_get_status_code(http_client);
     ESP_LOGI(TAG, "HTTP状态码: %d", status_code);
-    esp_http_client_cleanup(http_client);
+    // 响应已通过read_response读完，连接可复用；归还前恢复默认方法与超时
+    esp_http_client_set_method(http_client, HTTP_METHOD_GET);
+    esp_http_client_set_timeout_ms(http_client, 10000);
+    http_pool_release(http_client, status_code == 200 || status_code == 201);
     
-    free(buffer);
+    for (int i = 0; i < DL_PIPE_BUF_COUNT; i++) {
+        transfer_buf_free(ul_buffers[i]);
+    }
     fclose(f);
     
     if (status_code == 200 || status_code == 201) {
@@ -1088,7 +3933,161 @@ static void send_upload_complete(const char *filename, const char *md5)
     
     ESP_LOGI(TAG, "发送上传完成通知: %s", json_buffer);
     
-    esp_websocket_client_send_text(client, json_buffer, strlen(json_buffer), portMAX_DELAY);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+}
+
+// ---- 基准测试模式 ----
+// 由benchmark_request协议消息触发，分阶段隔离测量SPIFFS、哈希和HTTP
+// 吞吐并上报MB/s，用于区分"服务器慢/flash慢/WiFi差"，也让固件发布
+// 可以像回归功能一样回归吞吐量。
+
+// SPIFFS顺序写吞吐（MB/s），按block_size分块写BENCH_FILE_SIZE字节
+static float bench_spiffs_write(char *buf, size_t block_size)
+{
+    FILE *f = fopen(BENCH_FILE_PATH, "wb");
+    if (f == NULL) {
+        return -1.0f;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    size_t written = 0;
+    while (written < BENCH_FILE_SIZE) {
+        if (fwrite(buf, 1, block_size, f) != block_size) {
+            fclose(f);
+            unlink(BENCH_FILE_PATH);
+            return -1.0f;
+        }
+        written += block_size;
+    }
+    fflush(f);
+    fclose(f);
+    int64_t elapsed = esp_timer_get_time() - t0;
+
+    return (float)written / elapsed; // 字节/微秒 == MB/s
+}
+
+// SPIFFS顺序读吞吐（MB/s）
+static float bench_spiffs_read(char *buf, size_t block_size)
+{
+    FILE *f = fopen(BENCH_FILE_PATH, "rb");
+    if (f == NULL) {
+        return -1.0f;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    size_t total = 0;
+    size_t read_len;
+    while ((read_len = fread(buf, 1, block_size, f)) > 0) {
+        total += read_len;
+    }
+    fclose(f);
+    int64_t elapsed = esp_timer_get_time() - t0;
+
+    return (elapsed > 0) ? (float)total / elapsed : -1.0f;
+}
+
+// 哈希吞吐（MB/s），按4KB块喂入
+static float bench_hash(char *buf, size_t block_size, dl_hash_type_t type)
+{
+    dl_hash_ctx_t ctx;
+    char hex[65];
+
+    dl_hash_starts(&ctx, type);
+    int64_t t0 = esp_timer_get_time();
+    size_t fed = 0;
+    while (fed < BENCH_HASH_SIZE) {
+        dl_hash_update(&ctx, (const unsigned char *)buf, block_size);
+        fed += block_size;
+    }
+    int64_t elapsed = esp_timer_get_time() - t0;
+    dl_hash_finish(&ctx, hex);
+    dl_hash_free(&ctx);
+
+    return (elapsed > 0) ? (float)fed / elapsed : -1.0f;
+}
+
+// HTTP下载吞吐（MB/s）：只读不落盘，url为服务器提供的测试文件
+static float bench_http_download(const char *url, char *buf, size_t buf_size)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = 10000,
+    };
+    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    if (http_client == NULL) {
+        return -1.0f;
+    }
+
+    if (esp_http_client_open(http_client, 0) != ESP_OK) {
+        esp_http_client_cleanup(http_client);
+        return -1.0f;
+    }
+    esp_http_client_fetch_headers(http_client);
+
+    int64_t t0 = esp_timer_get_time();
+    size_t total = 0;
+    int read_len;
+    while ((read_len = esp_http_client_read(http_client, buf, buf_size)) > 0) {
+        total += read_len;
+    }
+    int64_t elapsed = esp_timer_get_time() - t0;
+    esp_http_client_cleanup(http_client);
+
+    return (elapsed > 0 && total > 0) ? (float)total / elapsed : -1.0f;
+}
+
+// 基准测试任务：依次跑完各阶段并上报结果后自删除
+// 参数为strdup出来的测试下载URL，可为NULL（跳过HTTP阶段）
+static void benchmark_task(void *pvParameter)
+{
+    char *url = (char *)pvParameter;
+    static char json_buffer[512];
+
+    ESP_LOGI(TAG, "开始基准测试");
+
+    size_t buf_size;
+    char *buf = transfer_buf_alloc(&buf_size);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "基准测试缓冲区分配失败");
+        free(url);
+        vTaskDelete(NULL);
+        return;
+    }
+    memset(buf, 0xA5, buf_size);
+
+    // SPIFFS各块大小的顺序写/读
+    static const size_t block_sizes[] = { 4096, 16384, 65536 };
+    float spiffs_write[3], spiffs_read[3];
+    for (int i = 0; i < 3; i++) {
+        size_t bs = (block_sizes[i] <= buf_size) ? block_sizes[i] : buf_size;
+        spiffs_write[i] = bench_spiffs_write(buf, bs);
+        spiffs_read[i] = bench_spiffs_read(buf, bs);
+    }
+    unlink(BENCH_FILE_PATH);
+
+    // 哈希吞吐
+    float md5_speed = bench_hash(buf, 4096, DL_HASH_MD5);
+    float sha256_speed = bench_hash(buf, 4096, DL_HASH_SHA256);
+
+    // HTTP裸下载（不落盘）
+    float http_speed = (url != NULL) ? bench_http_download(url, buf, buf_size) : -1.0f;
+
+    transfer_buf_free(buf);
+    free(url);
+
+    snprintf(json_buffer, sizeof(json_buffer),
+             "{\"type\":\"benchmark_result\",\"data\":{"
+             "\"spiffs_write_4k\":%.2f,\"spiffs_write_16k\":%.2f,\"spiffs_write_64k\":%.2f,"
+             "\"spiffs_read_4k\":%.2f,\"spiffs_read_16k\":%.2f,\"spiffs_read_64k\":%.2f,"
+             "\"md5_mbps\":%.2f,\"sha256_mbps\":%.2f,\"http_mbps\":%.2f}}",
+             spiffs_write[0], spiffs_write[1], spiffs_write[2],
+             spiffs_read[0], spiffs_read[1], spiffs_read[2],
+             md5_speed, sha256_speed, http_speed);
+
+    ESP_LOGI(TAG, "基准测试完成: %s", json_buffer);
+    tx_enqueue_reliable(false, json_buffer, strlen(json_buffer));
+
+    vTaskDelete(NULL);
 }
 
 // 初始化并启动WebSocket客户端
@@ -1099,21 +4098,36 @@ static void websocket_app_start(void)
     // 初始化设备信息
     init_device_info();
     
+    // 初始化下载管理器（任务队列与工作任务池）
+    if (dl_manager_init() != ESP_OK) {
+        return;
+    }
+
+    // 一次性分配RX消息池，消息热路径上不再动态分配
+    rx_pool = calloc(RX_POOL_SLOT_COUNT, sizeof(rx_slot_t));
+    if (rx_pool == NULL) {
+        ESP_LOGE(TAG, "分配RX消息池失败");
+        return;
+    }
+
     // 创建WebSocket事件队列
     ws_event_queue = xQueueCreate(WS_QUEUE_SIZE, sizeof(ws_event_msg_t));
     if (ws_event_queue == NULL) {
         ESP_LOGE(TAG, "创建WebSocket事件队列失败");
+        free(rx_pool);
+        rx_pool = NULL;
         return;
     }
     
-    // 创建WebSocket事件处理任务
-    BaseType_t task_created = xTaskCreate(
+    // 创建WebSocket事件处理任务（协议解析，与lwIP同核）
+    BaseType_t task_created = xTaskCreatePinnedToCore(
         ws_event_task,                 // 任务函数
         "ws_event_task",               // 任务名称
         WS_TASK_STACK_SIZE,            // 任务栈大小
         NULL,                          // 任务参数
         WS_TASK_PRIORITY,              // 任务优先级
-        &ws_task_handle                // 任务句柄
+        &ws_task_handle,               // 任务句柄
+        CORE_NET                       // 固定在网络核
     );
     
     if (task_created != pdPASS) {
@@ -1121,6 +4135,18 @@ static void websocket_app_start(void)
         vQueueDelete(ws_event_queue);
         return;
     }
+
+    // 创建出站发送队列与发送任务，所有socket发送集中到一个任务
+    tx_reliable_queue = xQueueCreate(TX_QUEUE_DEPTH, sizeof(tx_msg_t *));
+    tx_progress_mutex = xSemaphoreCreateMutex();
+    if (tx_reliable_queue == NULL || tx_progress_mutex == NULL ||
+        xTaskCreatePinnedToCore(tx_sender_task, "tx_sender", TX_SENDER_TASK_STACK_SIZE,
+                                NULL, TX_SENDER_TASK_PRIORITY, NULL, CORE_NET) != pdPASS) {
+        // 创建失败时退回直接发送（tx_enqueue_*对NULL队列有兜底）
+        ESP_LOGE(TAG, "创建出站发送任务失败，消息将直接发送");
+        if (tx_reliable_queue) { vQueueDelete(tx_reliable_queue); tx_reliable_queue = NULL; }
+        if (tx_progress_mutex) { vSemaphoreDelete(tx_progress_mutex); tx_progress_mutex = NULL; }
+    }
     
     // 构建WebSocket URL，使用设备ID作为路径参数
     snprintf(ws_url, sizeof(ws_url), "%s%s", CONFIG_WEBSOCKET_URI, device_id);
@@ -1156,13 +4182,15 @@ static void websocket_app_start(void)
     client = esp_websocket_client_init(&websocket_cfg);
     esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, NULL);
     
-    // 创建心跳定时器
-    heartbeat_timer = xTimerCreate("Heartbeat", HEARTBEAT_INTERVAL_SEC * 1000 / portTICK_PERIOD_MS,
-                                   pdTRUE, NULL, heartbeat_timer_callback);
+    // 创建心跳与遥测任务（低优先级，连接建立后开始发送）
+    if (xTaskCreatePinnedToCore(telemetry_task, "telemetry", TELEMETRY_TASK_STACK_SIZE,
+                                NULL, TELEMETRY_TASK_PRIORITY, NULL, CORE_NET) != pdPASS) {
+        ESP_LOGE(TAG, "创建遥测任务失败");
+    }
     
-    // 创建重连定时器
-    reconnect_timer = xTimerCreate("Reconnect", RECONNECT_INTERVAL_SEC * 1000 / portTICK_PERIOD_MS,
-                                   pdTRUE, NULL, reconnect_timer_callback);
+    // 创建重连定时器（单次触发，周期在每次调度时按退避重新计算）
+    reconnect_timer = xTimerCreate("Reconnect", RECONNECT_BACKOFF_MIN_MS / portTICK_PERIOD_MS,
+                                   pdFALSE, NULL, reconnect_timer_callback);
     
     // 连接WebSocket服务器
     ESP_LOGI(TAG, "正在连接到 %s...", websocket_cfg.uri);
@@ -1176,31 +4204,42 @@ void app_main(void)
     ESP_LOGI(TAG, "[APP] 可用内存: %" PRIu32 " 字节", esp_get_free_heap_size());
     ESP_LOGI(TAG, "[APP] IDF版本: %s", esp_get_idf_version());
     
-    // 设置日志级别 - 设置更详细的日志级别以便调试
-    // 默认情况下使用INFO级别
+    // 全局日志保持INFO；传输/消息子系统的热路径日志走异步环形缓冲，
+    // 级别由alog_subsys_level控制，可通过log_config消息在线调整
     esp_log_level_set("*", ESP_LOG_INFO);
-    // 为WebSocket客户端组件设置DEBUG级别
-    esp_log_level_set("esp_websocket_client", ESP_LOG_DEBUG);
-    esp_log_level_set("transport_ws", ESP_LOG_DEBUG);
-    esp_log_level_set("trans_tcp", ESP_LOG_DEBUG);
-    
-    // 设置FreeRTOS定时器服务任务栈大小
-    #if CONFIG_FREERTOS_USE_TIMERS
-    // 使用默认配置时，需在menuconfig中修改CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH值
-    ESP_LOGI(TAG, "定时器服务任务栈大小建议设置: %d字节", TIMER_SERVICE_TASK_STACK_SIZE);
-    #endif
+
+    // 启动异步日志排空任务
+    if (xTaskCreatePinnedToCore(alog_drain_task, "alog_drain", ALOG_TASK_STACK_SIZE,
+                                NULL, TELEMETRY_TASK_PRIORITY, NULL, CORE_WORK) != pdPASS) {
+        ESP_LOGW(TAG, "创建日志排空任务失败，异步日志将停留在缓冲区");
+    }
     
     // 初始化ESP-IDF组件
     ESP_ERROR_CHECK(nvs_flash_init());
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     
-    // 配置WiFi连接
+    // SPIFFS挂载/索引加载与WiFi关联互不依赖，并行执行后启动耗时
+    // 由较慢的一方（通常是WiFi，数秒）决定，而不是两者之和
+    spiffs_ready_sem = xSemaphoreCreateBinary();
+    bool spiffs_async = (spiffs_ready_sem != NULL &&
+                         xTaskCreatePinnedToCore(spiffs_init_task, "spiffs_init",
+                                                 SPIFFS_INIT_TASK_STACK_SIZE, NULL,
+                                                 WS_TASK_PRIORITY, NULL, CORE_WORK) == pdPASS);
+
+    // 配置WiFi连接（阻塞到拿到IP，期间SPIFFS在另一核上挂载）
     ESP_ERROR_CHECK(example_connect());
-    
-    // 初始化SPIFFS
-    ESP_ERROR_CHECK(init_spiffs());
-    
-    // 初始化并启动WebSocket客户端
+
+    if (spiffs_async) {
+        xSemaphoreTake(spiffs_ready_sem, portMAX_DELAY);
+        vSemaphoreDelete(spiffs_ready_sem);
+        spiffs_ready_sem = NULL;
+        ESP_ERROR_CHECK(spiffs_init_result);
+    } else {
+        // 并行初始化不可用时退回顺序启动
+        ESP_ERROR_CHECK(init_spiffs());
+    }
+
+    // IP与SPIFFS都就绪，立刻发起WebSocket连接
     websocket_app_start();
 }
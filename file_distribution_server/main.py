@@ -143,6 +143,70 @@ async def upload_file_impl(client_id: str, file: UploadFile):
             "message": f"文件处理失败: {str(e)}"
         }
 
+# 文件群发接口
+@app.post("/broadcast")
+async def broadcast_file(file: UploadFile = File(...), wave_size: int = 5,
+                         wave_interval: float = 2.0, rate_limit_kbps: int = 0):
+    """
+    上传文件并分波次通知所有在线客户端下载
+    波次大小、波次间隔和限速提示通过查询参数控制
+    """
+    try:
+        # 保存上传的文件
+        file_path, filename = await file_processor.save_uploaded_file(file, file.filename)
+
+        # 计算文件MD5
+        md5_hash = hashlib.md5()
+        with open(file_path, "rb") as f:
+            for chunk in iter(lambda: f.read(4096), b""):
+                md5_hash.update(chunk)
+        file_md5 = md5_hash.hexdigest()
+
+        # 获取文件大小
+        file_size = os.path.getsize(file_path)
+
+        clients = manager.get_active_clients()
+        if not clients:
+            return {
+                "status": "warning",
+                "message": "文件已上传，但当前没有在线客户端",
+                "filename": filename
+            }
+
+        # 构建下载信息
+        server_host = os.environ.get('SERVER_HOST', 'localhost')
+        server_port = os.environ.get('SERVER_PORT', '8000')
+        download_info = {
+            "filename": filename,
+            "size": file_size,
+            "md5": file_md5,
+            "url": f"http://{server_host}:{server_port}/download/{filename}"
+        }
+
+        # 分波次下发下载通知，错峰避免全员同时抢占上行带宽
+        notified = await manager.notify_group_to_download(
+            clients, download_info,
+            wave_size=wave_size, wave_interval=wave_interval,
+            rate_limit_kbps=rate_limit_kbps)
+
+        return {
+            "status": "success",
+            "message": f"文件已上传，已分波通知 {notified}/{len(clients)} 个客户端",
+            "filename": filename,
+            "md5": file_md5,
+            "size": file_size,
+            "notified": notified
+        }
+
+    except Exception as e:
+        print(f"文件群发处理错误: {str(e)}")
+        import traceback
+        traceback.print_exc()
+        return {
+            "status": "error",
+            "message": f"文件处理失败: {str(e)}"
+        }
+
 # 文件下载接口
 @app.get("/download/{filename}")
 async def download_file(filename: str):
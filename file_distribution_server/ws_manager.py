@@ -15,6 +15,8 @@ class ConnectionManager:
         self.device_info: Dict[str, Dict] = {}
         # Store device file list
         self.device_files: Dict[str, List[Dict]] = {}
+        # 分帧file_list的重组缓冲：{client_id: {"total_chunks": n, "chunks": {seq: files}}}
+        self.pending_file_lists: Dict[str, Dict] = {}
         # 心跳超时时间（秒）
         self.heartbeat_timeout = 10
         # 启动心跳检测任务
@@ -91,9 +93,28 @@ class ConnectionManager:
                 
             elif message_type == "file_list":
                 # Handle device file list
+                # 设备分帧上报清单（每帧带seq/total_chunks），全部到齐后再整体替换；
+                # 不带分帧字段的旧固件退化为单帧，行为与原来一致
                 data = message.get("data", {})
-                self.device_files[client_id] = data.get("files", [])
-                
+                files = data.get("files", [])
+                seq = data.get("seq", 0)
+                total_chunks = data.get("total_chunks", 1)
+
+                pending = self.pending_file_lists.get(client_id)
+                if pending is None or seq == 0 or pending.get("total_chunks") != total_chunks:
+                    # 新一轮清单从seq 0开始，丢弃未完成的旧重组缓冲
+                    pending = {"total_chunks": total_chunks, "chunks": {}}
+                    self.pending_file_lists[client_id] = pending
+                pending["chunks"][seq] = files
+
+                if len(pending["chunks"]) >= total_chunks:
+                    merged = []
+                    for i in range(total_chunks):
+                        merged.extend(pending["chunks"].get(i, []))
+                    self.device_files[client_id] = merged
+                    del self.pending_file_lists[client_id]
+                    print(f"Client {client_id} file list complete: {len(merged)} files in {total_chunks} chunks")
+
                 # Send confirmation response
                 response = {
                     "type": "file_list_ack",
@@ -101,7 +122,28 @@ class ConnectionManager:
                     "message": "File list received"
                 }
                 await self.send_message(client_id, response)
-                
+
+            elif message_type == "file_list_delta":
+                # 处理清单增量：下载完成后设备只上报变化的条目，
+                # 按filename更新或追加，避免整表重发
+                data = message.get("data", {})
+                files = self.device_files.setdefault(client_id, [])
+                for entry in data.get("files", []):
+                    for file_info in files:
+                        if file_info.get("filename") == entry.get("filename"):
+                            file_info.update(entry)
+                            break
+                    else:
+                        files.append(entry)
+
+                # Send confirmation response
+                response = {
+                    "type": "file_list_delta_ack",
+                    "status": "success",
+                    "message": "File list delta received"
+                }
+                await self.send_message(client_id, response)
+
             elif message_type == "download_ack":
                 # Handle download confirmation
                 print(f"Client {client_id} confirmed starting download file: {message.get('data', {}).get('filename')}")
@@ -304,6 +346,41 @@ class ConnectionManager:
             
         return success
     
+    async def notify_group_to_download(self, client_ids: List[str], file_info: dict,
+                                       wave_size: int = 5,
+                                       wave_interval: float = 2.0,
+                                       rate_limit_kbps: int = 0) -> int:
+        """分波次通知一组客户端下载同一文件，避免全员同时抢占上行带宽
+
+        同时向全部设备广播download_notify会让所有download_file同步开始，
+        共享一条上行时人人都在饥饿。这里按wave_size分波下发、波次间隔
+        wave_interval秒，并在通知中附带rate_limit_kbps提示（客户端以
+        令牌桶限速配合）。错峰让每台设备获得一段低争用的快速窗口，
+        总完成时间反而优于同时开抢。返回成功通知的客户端数量。
+        """
+        pending = [cid for cid in client_ids if cid in self.active_connections]
+        if not pending:
+            print("没有在线客户端可通知")
+            return 0
+        
+        info = dict(file_info)
+        if rate_limit_kbps > 0:
+            info["rate_limit_kbps"] = rate_limit_kbps
+        
+        notified = 0
+        for i in range(0, len(pending), wave_size):
+            wave = pending[i:i + wave_size]
+            print(f"下发第 {i // wave_size + 1} 波下载通知: {wave}")
+            results = await asyncio.gather(
+                *(self.notify_client_to_download(cid, info) for cid in wave)
+            )
+            notified += sum(1 for ok in results if ok)
+            if i + wave_size < len(pending):
+                await asyncio.sleep(wave_interval)
+        
+        print(f"分波通知完成: {notified}/{len(pending)} 台设备已接收")
+        return notified
+    
     async def notify_client_to_upload(self, client_id: str, file_info: dict) -> bool:
         """Request client to upload a file"""
         if client_id not in self.active_connections: